@@ -39,6 +39,7 @@
 
 #include "RtMidi.h"
 #include <sstream>
+#include <cstring>
 
 #if defined(__MACOSX_CORE__)
   #if TARGET_OS_IPHONE
@@ -95,6 +96,7 @@ class MidiOutCore: public MidiOutApi
   unsigned int getPortCount( void );
   std::string getPortName( unsigned int portNumber );
   void sendMessage( const unsigned char *message, size_t size );
+  RtMidiOut::SendStatus tryQueueMessage( const unsigned char *message, size_t size );
 
  protected:
   void initialize( const std::string& clientName );
@@ -139,6 +141,7 @@ class MidiOutJack: public MidiOutApi
   unsigned int getPortCount( void );
   std::string getPortName( unsigned int portNumber );
   void sendMessage( const unsigned char *message, size_t size );
+  RtMidiOut::SendStatus tryQueueMessage( const unsigned char *message, size_t size );
 
  protected:
   std::string clientName;
@@ -164,9 +167,17 @@ class MidiInAlsa: public MidiInApi
   void setPortName( const std::string &portName);
   unsigned int getPortCount( void );
   std::string getPortName( unsigned int portNumber );
+  void getPorts( std::vector<RtMidiPortInfo> &ports );
+  bool setKernelRoute( const RtMidiPortInfo &target );
+  bool setExternalLoop( bool external );
+  bool setSysexStreaming( bool stream );
+  int getPollDescriptors( int *fds, int maxFds );
+  void processEvents( void );
 
  protected:
   void initialize( const std::string& clientName );
+  int startInput( pthread_attr_t *attr );
+  void stopInput( void );
 };
 
 class MidiOutAlsa: public MidiOutApi
@@ -182,9 +193,17 @@ class MidiOutAlsa: public MidiOutApi
   void setPortName( const std::string &portName );
   unsigned int getPortCount( void );
   std::string getPortName( unsigned int portNumber );
+  void getPorts( std::vector<RtMidiPortInfo> &ports );
+  void openPortAt( const RtMidiPortInfo &port, const std::string &portName );
   void sendMessage( const unsigned char *message, size_t size );
+  void queueMessage( const unsigned char *message, size_t size );
+  void flushMessages( void );
+  RtMidiOut::SendStatus tryQueueMessage( const unsigned char *message, size_t size );
+  RtMidiOut::SendStatus tryFlushMessages( void );
+  void setDirectEvents( bool direct );
 
  protected:
+  void subscribe( int client, int port, const std::string &portName );
   void initialize( const std::string& clientName );
 };
 
@@ -224,6 +243,7 @@ class MidiOutWinMM: public MidiOutApi
   unsigned int getPortCount( void );
   std::string getPortName( unsigned int portNumber );
   void sendMessage( const unsigned char *message, size_t size );
+  RtMidiOut::SendStatus tryQueueMessage( const unsigned char *message, size_t size );
 
  protected:
   void initialize( const std::string& clientName );
@@ -263,6 +283,7 @@ class MidiOutDummy: public MidiOutApi
   unsigned int getPortCount( void ) { return 0; }
   std::string getPortName( unsigned int /*portNumber*/ ) { return ""; }
   void sendMessage( const unsigned char * /*message*/, size_t /*size*/ ) {}
+  RtMidiOut::SendStatus tryQueueMessage( const unsigned char * /*message*/, size_t /*size*/ ) { return countStatus( RtMidiOut::SEND_PORT_GONE ); }
 
  protected:
   void initialize( const std::string& /*clientName*/ ) {}
@@ -375,6 +396,11 @@ void RtMidi :: setPortName( const std::string &portName )
   rtapi_->setPortName( portName );
 }
 
+void RtMidi :: getPorts( std::vector<RtMidiPortInfo> &ports )
+{
+  rtapi_->getPorts( ports );
+}
+
 
 //*********************************************************************//
 //  RtMidiIn Definitions
@@ -529,6 +555,21 @@ void MidiApi :: setErrorCallback( RtMidiErrorCallback errorCallback, void *userD
     errorCallbackUserData_ = userData;
 }
 
+// Port list for the APIs that only know port numbers.
+void MidiApi :: listPorts( std::vector<RtMidiPortInfo> &ports, unsigned int caps )
+{
+  ports.clear();
+  unsigned int nPorts = getPortCount();
+  for ( unsigned int i = 0; i < nPorts; i++ ) {
+    RtMidiPortInfo info;
+    info.name = getPortName( i );
+    info.client = -1;
+    info.port = i;
+    info.caps = caps;
+    ports.push_back( info );
+  }
+}
+
 void MidiApi :: error( RtMidiError::Type type, std::string errorString )
 {
   if ( errorCallback_ ) {
@@ -566,15 +607,11 @@ MidiInApi :: MidiInApi( unsigned int queueSizeLimit )
   : MidiApi()
 {
   // Allocate the MIDI queue.
-  inputData_.queue.ringSize = queueSizeLimit;
-  if ( inputData_.queue.ringSize > 0 )
-    inputData_.queue.ring = new MidiMessage[ inputData_.queue.ringSize ];
+  inputData_.queue.allocate( queueSizeLimit );
 }
 
 MidiInApi :: ~MidiInApi( void )
 {
-  // Delete the MIDI queue.
-  if ( inputData_.queue.ringSize > 0 ) delete [] inputData_.queue.ring;
 }
 
 void MidiInApi :: setCallback( RtMidiIn::RtMidiCallback callback, void *userData )
@@ -605,10 +642,46 @@ void MidiInApi :: cancelCallback()
   }
 
   inputData_.userCallback = 0;
+  inputData_.spanCallback = 0;
   inputData_.userData = 0;
   inputData_.usingCallback = false;
 }
 
+void MidiInApi :: setSpanCallback( RtMidiIn::RtMidiSpanCallback callback, void *userData )
+{
+  if ( inputData_.usingCallback ) {
+    errorString_ = "MidiInApi::setSpanCallback: a callback function is already set!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  if ( !callback ) {
+    errorString_ = "RtMidiIn::setSpanCallback: callback function value is invalid!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  inputData_.spanCallback = callback;
+  inputData_.userData = userData;
+  inputData_.usingCallback = true;
+}
+
+// Hands a completed message to whichever of the two callbacks is set.
+static inline void invokeCallback( MidiInApi::RtMidiInData *data, MidiInApi::MidiMessage &message )
+{
+  if ( data->spanCallback )
+    data->spanCallback( (long long)( message.timeStamp * 1000000.0 + 0.5 ),
+                        message.bytes.data(), message.bytes.size(), data->userData );
+  else
+    data->userCallback( message.timeStamp, &message.bytes, data->userData );
+}
+
+void MidiInApi :: setBatchCallback( RtMidiIn::RtMidiBatchCallback callback, void *userData )
+{
+  inputData_.batchUserData = userData;
+  inputData_.batchCallback = callback;
+}
+
 void MidiInApi :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense )
 {
   inputData_.ignoreFlags = 0;
@@ -634,60 +707,89 @@ double MidiInApi :: getMessage( std::vector<unsigned char> *message )
   return timeStamp;
 }
 
-unsigned int MidiInApi::MidiQueue::size( unsigned int *__back,
-                                         unsigned int *__front )
+// Smallest slab, a few DX7 or TX81Z bulk dumps fit without being dropped.
+const unsigned int MIDI_QUEUE_SLAB_MIN = 65536;
+
+static unsigned int nextPowerOfTwo( unsigned int n )
 {
-  // Access back/front members exactly once and make stack copies for
-  // size calculation
-  unsigned int _back = back, _front = front, _size;
-  if ( _back >= _front )
-    _size = _back - _front;
-  else
-    _size = ringSize - _front + _back;
+  unsigned int p = 1;
+  while ( p < n ) p <<= 1;
+  return p;
+}
 
-  // Return copies of back/front so no new and unsynchronized accesses
-  // to member variables are needed.
-  if ( __back ) *__back = _back;
-  if ( __front ) *__front = _front;
-  return _size;
+MidiInApi::MidiQueue::~MidiQueue()
+{
+  delete [] ring;
+  delete [] slab;
+}
+
+void MidiInApi::MidiQueue::allocate( unsigned int limit )
+{
+  if ( limit == 0 ) return;
+  ringSize = nextPowerOfTwo( limit );
+  ring = new Slot[ ringSize ];
+  slabSize = nextPowerOfTwo( limit * 64 > MIDI_QUEUE_SLAB_MIN ? limit * 64 : MIDI_QUEUE_SLAB_MIN );
+  slab = new unsigned char[ slabSize ];
+}
+
+unsigned int MidiInApi::MidiQueue::size( void ) const
+{
+  return back.load( std::memory_order_acquire ) - front.load( std::memory_order_acquire );
 }
 
-// As long as we haven't reached our queue size limit, push the message.
 bool MidiInApi::MidiQueue::push( const MidiInApi::MidiMessage& msg )
 {
-  // Local stack copies of front/back
-  unsigned int _back, _front, _size;
+  return push( msg.bytes.data(), msg.bytes.size(), msg.timeStamp );
+}
 
-  // Get back/front indexes exactly once and calculate current size
-  _size = size( &_back, &_front );
+// As long as we haven't reached our queue size limit, push the message.
+bool MidiInApi::MidiQueue::push( const unsigned char *bytes, size_t nBytes, double timeStamp )
+{
+  unsigned int _back = back.load( std::memory_order_relaxed );
+  if ( _back - front.load( std::memory_order_acquire ) >= ringSize )
+    return false;
 
-  if ( _size < ringSize-1 )
-  {
-    ring[_back] = msg;
-    back = (back+1)%ringSize;
-    return true;
+  Slot &slot = ring[ _back & ( ringSize - 1 ) ];
+  if ( nBytes > INLINE_BYTES ) {
+    if ( nBytes > slabSize ) return false;
+    // Keep the message in one piece, the bytes up to the end of the slab are skipped.
+    unsigned int start = slabBack;
+    unsigned int room = slabSize - ( start & ( slabSize - 1 ) );
+    if ( room < nBytes ) start += room;
+    if ( start + nBytes - slabFront.load( std::memory_order_acquire ) > slabSize )
+      return false;
+    memcpy( &slab[ start & ( slabSize - 1 ) ], bytes, nBytes );
+    slot.offset = start;
+    slabBack = start + nBytes;
   }
+  else
+    memcpy( slot.bytes, bytes, nBytes );
+  slot.size = nBytes;
+  slot.timeStamp = timeStamp;
 
-  return false;
+  back.store( _back + 1, std::memory_order_release );
+  return true;
 }
 
 bool MidiInApi::MidiQueue::pop( std::vector<unsigned char> *msg, double* timeStamp )
 {
-  // Local stack copies of front/back
-  unsigned int _back, _front, _size;
-
-  // Get back/front indexes exactly once and calculate current size
-  _size = size( &_back, &_front );
-
-  if ( _size == 0 )
+  unsigned int _front = front.load( std::memory_order_relaxed );
+  if ( back.load( std::memory_order_acquire ) == _front )
     return false;
 
   // Copy queued message to the vector pointer argument and then "pop" it.
-  msg->assign( ring[_front].bytes.begin(), ring[_front].bytes.end() );
-  *timeStamp = ring[_front].timeStamp;
+  // The vector keeps its capacity, a polling reader stops allocating.
+  const Slot &slot = ring[ _front & ( ringSize - 1 ) ];
+  if ( slot.size > INLINE_BYTES ) {
+    const unsigned char *bytes = &slab[ slot.offset & ( slabSize - 1 ) ];
+    msg->assign( bytes, bytes + slot.size );
+    slabFront.store( slot.offset + slot.size, std::memory_order_release );
+  }
+  else
+    msg->assign( slot.bytes, slot.bytes + slot.size );
+  *timeStamp = slot.timeStamp;
 
-  // Update front
-  front = (front+1)%ringSize;
+  front.store( _front + 1, std::memory_order_release );
   return true;
 }
 
@@ -698,12 +800,33 @@ bool MidiInApi::MidiQueue::pop( std::vector<unsigned char> *msg, double* timeSta
 MidiOutApi :: MidiOutApi( void )
   : MidiApi()
 {
+  stats_.messages = 0;
+  stats_.writes = 0;
+  stats_.wouldBlock = 0;
+  stats_.portGone = 0;
+  stats_.encodeErrors = 0;
 }
 
 MidiOutApi :: ~MidiOutApi( void )
 {
 }
 
+RtMidiOut::SendStatus MidiOutApi :: countStatus( RtMidiOut::SendStatus status )
+{
+  switch ( status ) {
+  case RtMidiOut::SEND_WOULD_BLOCK: stats_.wouldBlock++; break;
+  case RtMidiOut::SEND_PORT_GONE: stats_.portGone++; break;
+  case RtMidiOut::SEND_ENCODE_ERROR: stats_.encodeErrors++; break;
+  default: break;
+  }
+  return status;
+}
+
+RtMidiOut::SendStatus MidiOutApi :: tryFlushMessages( void )
+{
+  return RtMidiOut::SEND_OK;
+}
+
 // *************************************************** //
 //
 // OS/API-specific methods.
@@ -800,8 +923,7 @@ static void midiInputCallback( const MIDIPacketList *list, void *procRef, void *
       if ( !( data->ignoreFlags & 0x01 ) && !continueSysex ) {
         // If not a continuing sysex message, invoke the user callback function or queue the message.
         if ( data->usingCallback ) {
-          RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-          callback( message.timeStamp, &message.bytes, data->userData );
+          invokeCallback( data, message );
         }
         else {
           // As long as we haven't reached our queue size limit, push the message.
@@ -859,8 +981,7 @@ static void midiInputCallback( const MIDIPacketList *list, void *procRef, void *
           if ( !continueSysex ) {
             // If not a continuing sysex message, invoke the user callback function or queue the message.
             if ( data->usingCallback ) {
-              RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-              callback( message.timeStamp, &message.bytes, data->userData );
+              invokeCallback( data, message );
             }
             else {
               // As long as we haven't reached our queue size limit, push the message.
@@ -1392,25 +1513,32 @@ void MidiOutCore :: openVirtualPort( const std::string &portName )
 }
 
 void MidiOutCore :: sendMessage( const unsigned char *message, size_t size )
+{
+  switch ( tryQueueMessage( message, size ) ) {
+  case RtMidiOut::SEND_ENCODE_ERROR:
+    errorString_ = "MidiOutCore::sendMessage: message format problem ... empty, or not sysex but > 3 bytes?";
+    error( RtMidiError::WARNING, errorString_ );
+    break;
+  case RtMidiOut::SEND_WOULD_BLOCK:
+  case RtMidiOut::SEND_PORT_GONE:
+    errorString_ = "MidiOutCore::sendMessage: error sending MIDI message to port.";
+    error( RtMidiError::WARNING, errorString_ );
+    break;
+  default:
+    break;
+  }
+}
+
+RtMidiOut::SendStatus MidiOutCore :: tryQueueMessage( const unsigned char *message, size_t size )
 {
   // We use the MIDISendSysex() function to asynchronously send sysex
   // messages.  Otherwise, we use a single CoreMidi MIDIPacket.
   unsigned int nBytes = static_cast<unsigned int> (size);
-  if ( nBytes == 0 ) {
-    errorString_ = "MidiOutCore::sendMessage: no data in message argument!";
-    error( RtMidiError::WARNING, errorString_ );
-    return;
-  }
+  if ( nBytes == 0 || ( message[0] != 0xF0 && nBytes > 3 ) )
+    return countStatus( RtMidiOut::SEND_ENCODE_ERROR );
 
   MIDITimeStamp timeStamp = AudioGetCurrentHostTime();
   CoreMidiData *data = static_cast<CoreMidiData *> (apiData_);
-  OSStatus result;
-
-  if ( message[0] != 0xF0 && nBytes > 3 ) {
-    errorString_ = "MidiOutCore::sendMessage: message format problem ... not sysex but > 3 bytes?";
-    error( RtMidiError::WARNING, errorString_ );
-    return;
-  }
 
   Byte buffer[nBytes+(sizeof( MIDIPacketList ))];
   ByteCount listSize = sizeof( buffer );
@@ -1425,29 +1553,19 @@ void MidiOutCore :: sendMessage( const unsigned char *message, size_t size )
     remainingBytes -= bytesForPacket;
   }
 
-  if ( !packet ) {
-    errorString_ = "MidiOutCore::sendMessage: could not allocate packet list";
-    error( RtMidiError::DRIVER_ERROR, errorString_ );
-    return;
-  }
-
-  // Send to any destinations that may have connected to us.
-  if ( data->endpoint ) {
-    result = MIDIReceived( data->endpoint, packetList );
-    if ( result != noErr ) {
-      errorString_ = "MidiOutCore::sendMessage: error sending MIDI to virtual destinations.";
-      error( RtMidiError::WARNING, errorString_ );
-    }
-  }
+  if ( !packet ) return countStatus( RtMidiOut::SEND_ENCODE_ERROR );
 
-  // And send to an explicit destination port if we're connected.
-  if ( connected_ ) {
-    result = MIDISend( data->port, data->destinationId, packetList );
-    if ( result != noErr ) {
-      errorString_ = "MidiOutCore::sendMessage: error sending MIDI message to port.";
-      error( RtMidiError::WARNING, errorString_ );
-    }
-  }
+  // Send to any destinations that may have connected to us, and to an
+  // explicit destination port if we're connected.
+  bool failed = false;
+  if ( data->endpoint && MIDIReceived( data->endpoint, packetList ) != noErr )
+    failed = true;
+  if ( connected_ && MIDISend( data->port, data->destinationId, packetList ) != noErr )
+    failed = true;
+  if ( failed ) return countStatus( RtMidiOut::SEND_PORT_GONE );
+  stats_.messages++;
+  stats_.writes++;
+  return RtMidiOut::SEND_OK;
 }
 
 #endif  // __MACOSX_CORE__
@@ -1493,6 +1611,15 @@ struct AlsaMidiData {
   snd_seq_real_time_t lastTime;
   int queue_id; // an input queue is needed to get timestamped events
   int trigger_fds[2];
+  bool external; // no input thread, the application calls MidiInAlsa::processEvents()
+  struct AlsaInputState *input; // decoder state for processEvents()
+  pthread_mutex_t routeLock; // guards the fields below, taken by the input thread and setKernelRoute()
+  int routeClient; // setKernelRoute() target, -1 if none
+  int routePort;
+  std::vector<snd_seq_addr_t> senders; // ports connected to the input port
+  bool useCoder; // output: encode everything with the coder, see RtMidiOut::setDirectEvents()
+  bool streamSysex; // input: hand SysEx on chunk by chunk, see RtMidiIn::setSysexStreaming()
+  bool sysexOpen;   // output: a SysEx was started and not ended yet
 };
 
 #define PORT_TYPE( pinfo, bits ) ((snd_seq_port_info_get_capability(pinfo) & (bits)) == (bits))
@@ -1502,38 +1629,343 @@ struct AlsaMidiData {
 //  Class Definitions: MidiInAlsa
 //*********************************************************************//
 
-static void *alsaMidiHandler( void *ptr )
+// Decoder state of an input loop. It lives across events because the
+// sequencer splits SysEx into 256 byte chunks that are put back together.
+// Messages collected for the batch callback before they are handed over.
+const size_t ALSA_BATCH_MAX = 256;
+
+// Longest SysEx that is reassembled, longer ones are dropped. Holds a
+// DX7 or TX81Z 32 voice bulk dump (4104 bytes) many times over.
+const size_t ALSA_SYSEX_MAX = 65536;
+
+struct AlsaInputState {
+  MidiInApi::MidiMessage message; // reserved for ALSA_SYSEX_MAX, never grows
+  unsigned char *buffer;          // decoder output, short messages only
+  bool continueSysex;
+  // SysEx split over several events is joined here, allocated once.
+  unsigned char *sysex;
+  size_t sysexSize;
+  bool sysexDropped; // longer than ALSA_SYSEX_MAX, skipped up to its F7
+  // Batch callback: bytes of the burst, the records point into them
+  // once it is handed over, until then they hold offsets.
+  std::vector<unsigned char> batchBytes;
+  std::vector<RtMidiIn::RtMidiInRecord> batch;
+  std::vector<size_t> batchOffsets;
+};
+
+static bool alsaInputStart( MidiInApi::RtMidiInData *data, AlsaInputState *state )
 {
-  MidiInApi::RtMidiInData *data = static_cast<MidiInApi::RtMidiInData *> (ptr);
   AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
-
-  long nBytes;
-  double time;
-  bool continueSysex = false;
-  bool doDecode = false;
-  MidiInApi::MidiMessage message;
-  int poll_fd_count;
-  struct pollfd *poll_fds;
-
-  snd_seq_event_t *ev;
-  int result;
+  state->continueSysex = false;
+  state->sysexSize = 0;
+  state->sysexDropped = false;
+  state->message.bytes.reserve( ALSA_SYSEX_MAX );
+  state->batchBytes.reserve( ALSA_SYSEX_MAX );
+  state->batch.reserve( ALSA_BATCH_MAX );
+  state->batchOffsets.reserve( ALSA_BATCH_MAX );
   apiData->bufferSize = 32;
-  result = snd_midi_event_new( 0, &apiData->coder );
+  int result = snd_midi_event_new( 0, &apiData->coder );
   if ( result < 0 ) {
     data->doInput = false;
     std::cerr << "\nMidiInAlsa::alsaMidiHandler: error initializing MIDI event parser!\n\n";
-    return 0;
+    return false;
   }
-  unsigned char *buffer = (unsigned char *) malloc( apiData->bufferSize );
-  if ( buffer == NULL ) {
+  state->buffer = (unsigned char *) malloc( apiData->bufferSize );
+  state->sysex = (unsigned char *) malloc( ALSA_SYSEX_MAX );
+  if ( state->buffer == NULL || state->sysex == NULL ) {
     data->doInput = false;
+    free( state->buffer );
+    free( state->sysex );
+    state->buffer = 0;
+    state->sysex = 0;
     snd_midi_event_free( apiData->coder );
     apiData->coder = 0;
     std::cerr << "\nMidiInAlsa::alsaMidiHandler: error initializing buffer memory!\n\n";
-    return 0;
+    return false;
   }
   snd_midi_event_init( apiData->coder );
   snd_midi_event_no_status( apiData->coder, 1 ); // suppress running status messages
+  return true;
+}
+
+static void alsaInputStop( MidiInApi::RtMidiInData *data, AlsaInputState *state )
+{
+  AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
+  if ( state->buffer ) free( state->buffer );
+  if ( state->sysex ) free( state->sysex );
+  state->buffer = 0;
+  state->sysex = 0;
+  snd_midi_event_free( apiData->coder );
+  apiData->coder = 0;
+}
+
+// Connects or disconnects sender and the kernel route target directly,
+// the events then go from one to the other without reaching this client.
+static int alsaRoute( AlsaMidiData *apiData, const snd_seq_addr_t &sender, bool connect )
+{
+  snd_seq_addr_t dest;
+  snd_seq_port_subscribe_t *sub;
+  snd_seq_port_subscribe_alloca( &sub );
+  dest.client = apiData->routeClient;
+  dest.port = apiData->routePort;
+  snd_seq_port_subscribe_set_sender( sub, &sender );
+  snd_seq_port_subscribe_set_dest( sub, &dest );
+  if ( connect )
+    return snd_seq_subscribe_port( apiData->seq, sub );
+  return snd_seq_unsubscribe_port( apiData->seq, sub );
+}
+
+// Lets every event type reach this client again, the way it was before
+// setKernelRoute(). Adding all of them rather than clearing the filter:
+// a filter that is switched on but empty lets nothing through.
+static void alsaClearEventFilter( snd_seq_t *seq )
+{
+  snd_seq_client_info_t *info;
+  snd_seq_client_info_alloca( &info );
+  if ( snd_seq_get_client_info( seq, info ) < 0 ) return;
+  for ( int type = 0; type < 256; type++ )
+    snd_seq_client_info_event_filter_add( info, type );
+  snd_seq_set_client_info( seq, info );
+}
+
+// Undoes setKernelRoute(), the caller holds routeLock.
+static void alsaClearRoute( AlsaMidiData *apiData )
+{
+  if ( apiData->routeClient >= 0 ) {
+    for ( size_t i = 0; i < apiData->senders.size(); i++ )
+      alsaRoute( apiData, apiData->senders[i], false ); // one that never got connected just fails
+    apiData->routeClient = -1;
+  }
+  alsaClearEventFilter( apiData->seq );
+}
+
+// Keeps the list of ports connected to our input, routed if a target is set.
+static void alsaTrackSender( AlsaMidiData *apiData, const snd_seq_addr_t &sender, bool connected )
+{
+  pthread_mutex_lock( &apiData->routeLock );
+  std::vector<snd_seq_addr_t> &senders = apiData->senders;
+  size_t i = 0;
+  while ( i < senders.size() && ( senders[i].client != sender.client || senders[i].port != sender.port ) ) i++;
+  if ( connected && i == senders.size() )
+    senders.push_back( sender );
+  else if ( !connected && i < senders.size() )
+    senders.erase( senders.begin() + i );
+  else {
+    pthread_mutex_unlock( &apiData->routeLock );
+    return;
+  }
+  if ( apiData->routeClient >= 0 )
+    alsaRoute( apiData, sender, connected );
+  pthread_mutex_unlock( &apiData->routeLock );
+}
+
+// Nanoseconds since the previous message, 0 for the first one.
+static long long alsaEventNs( MidiInApi::RtMidiInData *data, AlsaMidiData *apiData, snd_seq_event_t *ev )
+{
+  // Method 1: Use the system time.
+  //(void)gettimeofday(&tv, (struct timezone *)NULL);
+  //time = (tv.tv_sec * 1000000) + tv.tv_usec;
+
+  // Method 2: Use the ALSA sequencer event time data.
+  // (thanks to Pedro Lopez-Cabanillas!).
+
+  // snd_seq_real_time_t has unsigned fields, the difference is taken in
+  // signed 64 bit nanoseconds so no carry between the fields is needed.
+  snd_seq_real_time_t &x( ev->time.time );
+  long long time = ( (long long)x.tv_sec - (long long)apiData->lastTime.tv_sec ) * 1000000000LL
+                 + ( (long long)x.tv_nsec - (long long)apiData->lastTime.tv_nsec );
+
+  apiData->lastTime = ev->time.time;
+
+  if ( data->firstMessage == true ) {
+    data->firstMessage = false;
+    return 0;
+  }
+  return time;
+}
+
+// Hands the collected burst to the batch callback.
+static void alsaBatchFlush( MidiInApi::RtMidiInData *data, AlsaInputState *state )
+{
+  if ( state->batch.empty() ) return;
+  for ( size_t i = 0; i < state->batch.size(); i++ )
+    state->batch[i].bytes = &state->batchBytes[state->batchOffsets[i]];
+  if ( data->batchCallback )
+    data->batchCallback( &state->batch[0], state->batch.size(), data->batchUserData );
+  state->batch.clear();
+  state->batchOffsets.clear();
+  state->batchBytes.clear();
+}
+
+// Hands a complete message to the batch, the callback or the queue, the
+// first of them that is set. bytes only has to stay valid for the call.
+// Frees ev.
+static void alsaDeliver( MidiInApi::RtMidiInData *data, AlsaInputState *state, snd_seq_event_t *ev,
+                         const unsigned char *bytes, size_t nBytes )
+{
+  AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
+  long long time = alsaEventNs( data, apiData, ev );
+  snd_seq_free_event( ev );
+
+  if ( data->batchCallback ) {
+    // Flushed early rather than letting the reserved buffers grow.
+    if ( state->batchBytes.size() + nBytes > state->batchBytes.capacity() )
+      alsaBatchFlush( data, state );
+    RtMidiIn::RtMidiInRecord record;
+    record.timeStamp = time * 1e-9;
+    record.bytes = 0;
+    record.size = nBytes;
+    state->batchOffsets.push_back( state->batchBytes.size() );
+    state->batchBytes.insert( state->batchBytes.end(), bytes, bytes + nBytes );
+    state->batch.push_back( record );
+    if ( state->batch.size() >= ALSA_BATCH_MAX ) alsaBatchFlush( data, state );
+  }
+  else if ( data->spanCallback )
+    data->spanCallback( time / 1000, bytes, nBytes, data->userData );
+  else if ( data->usingCallback ) {
+    MidiInApi::MidiMessage &message = state->message;
+    message.bytes.assign( bytes, bytes + nBytes );
+    message.timeStamp = time * 1e-9;
+    invokeCallback( data, message );
+  }
+  else {
+    // As long as we haven't reached our queue size limit, push the message.
+    if ( !data->queue.push( bytes, nBytes, time * 1e-9 ) )
+      std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
+  }
+}
+
+// Decodes one sequencer event and hands a completed message to the
+// callback or the queue. Frees ev.
+static void alsaInputEvent( MidiInApi::RtMidiInData *data, AlsaInputState *state, snd_seq_event_t *ev )
+{
+  AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
+  bool &continueSysex = state->continueSysex;
+  unsigned char *buffer = state->buffer;
+  long nBytes;
+  bool doDecode = false;
+  bool sysex = false;
+
+  // Control changes are already parsed, skip the coder whoever gets them.
+  if ( ev->type == SND_SEQ_EVENT_CONTROLLER ) {
+    unsigned char control[3] = { (unsigned char) ( 0xB0 | ( ev->data.control.channel & 0x0F ) ),
+                                 (unsigned char) ( ev->data.control.param & 0x7F ),
+                                 (unsigned char) ( ev->data.control.value & 0x7F ) };
+    alsaDeliver( data, state, ev, control, 3 );
+    return;
+  }
+
+  // This is a bit weird, but we now have to decode an ALSA MIDI
+  // event (back) into MIDI bytes.  We'll ignore non-MIDI types.
+  doDecode = false;
+  switch ( ev->type ) {
+
+  case SND_SEQ_EVENT_PORT_SUBSCRIBED:
+#if defined(__RTMIDI_DEBUG__)
+    std::cout << "MidiInAlsa::alsaMidiHandler: port connection made!\n";
+#endif
+    alsaTrackSender( apiData, ev->data.connect.sender, true );
+    break;
+
+  case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
+    alsaTrackSender( apiData, ev->data.connect.sender, false );
+#if defined(__RTMIDI_DEBUG__)
+    std::cerr << "MidiInAlsa::alsaMidiHandler: port connection has closed!\n";
+    std::cout << "sender = " << (int) ev->data.connect.sender.client << ":"
+              << (int) ev->data.connect.sender.port
+              << ", dest = " << (int) ev->data.connect.dest.client << ":"
+              << (int) ev->data.connect.dest.port
+              << std::endl;
+#endif
+    break;
+
+  case SND_SEQ_EVENT_QFRAME: // MIDI time code
+    if ( !( data->ignoreFlags & 0x02 ) ) doDecode = true;
+    break;
+
+  case SND_SEQ_EVENT_TICK: // 0xF9 ... MIDI timing tick
+    if ( !( data->ignoreFlags & 0x02 ) ) doDecode = true;
+    break;
+
+  case SND_SEQ_EVENT_CLOCK: // 0xF8 ... MIDI timing (clock) tick
+    if ( !( data->ignoreFlags & 0x02 ) ) doDecode = true;
+    break;
+
+  case SND_SEQ_EVENT_SENSING: // Active sensing
+    if ( !( data->ignoreFlags & 0x04 ) ) doDecode = true;
+    break;
+
+  case SND_SEQ_EVENT_SYSEX:
+    // Already raw MIDI bytes, they are taken without the decoder.
+    if ( (data->ignoreFlags & 0x01) ) break;
+    sysex = true;
+    break;
+
+  default:
+    doDecode = true;
+  }
+
+  if ( sysex && ev->data.ext.len > 0 ) {
+    // The ALSA sequencer has a maximum buffer size for MIDI sysex
+    // events of 256 bytes.  If a device sends sysex messages larger
+    // than this, they are segmented into 256 byte chunks.  So,
+    // we'll watch for this and concatenate sysex chunks into a
+    // single sysex message if necessary.
+    const unsigned char *chunk = (const unsigned char *) ev->data.ext.ptr;
+    size_t len = ev->data.ext.len;
+    if ( apiData->streamSysex ) {
+      // Each chunk is handed on as it is, the receiver sees the framing.
+      continueSysex = ( chunk[len - 1] != 0xF7 );
+      alsaDeliver( data, state, ev, chunk, len );
+      return;
+    }
+    if ( !continueSysex ) {
+      state->sysexSize = 0;
+      state->sysexDropped = false;
+    }
+    if ( state->sysexDropped || state->sysexSize + len > ALSA_SYSEX_MAX )
+      state->sysexDropped = true;
+    else {
+      memcpy( state->sysex + state->sysexSize, chunk, len );
+      state->sysexSize += len;
+    }
+    continueSysex = ( chunk[len - 1] != 0xF7 );
+    if ( continueSysex || state->sysexDropped ) {
+      if ( !continueSysex )
+        std::cerr << "\nMidiInAlsa::alsaMidiHandler: SysEx message longer than " << ALSA_SYSEX_MAX << " bytes dropped!\n\n";
+      snd_seq_free_event( ev );
+      return;
+    }
+    alsaDeliver( data, state, ev, state->sysex, state->sysexSize );
+    return;
+  }
+
+  if ( doDecode ) {
+    nBytes = snd_midi_event_decode( apiData->coder, buffer, apiData->bufferSize, ev );
+    if ( nBytes > 0 ) {
+      alsaDeliver( data, state, ev, buffer, nBytes );
+      return;
+    }
+#if defined(__RTMIDI_DEBUG__)
+    std::cerr << "\nMidiInAlsa::alsaMidiHandler: event parsing error or not a MIDI event!\n\n";
+#endif
+  }
+
+  snd_seq_free_event( ev );
+}
+
+static void *alsaMidiHandler( void *ptr )
+{
+  MidiInApi::RtMidiInData *data = static_cast<MidiInApi::RtMidiInData *> (ptr);
+  AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
+
+  AlsaInputState state;
+  int poll_fd_count;
+  struct pollfd *poll_fds;
+
+  snd_seq_event_t *ev;
+  int result;
+  if ( !alsaInputStart( data, &state ) ) return 0;
 
   poll_fd_count = snd_seq_poll_descriptors_count( apiData->seq, POLLIN ) + 1;
   poll_fds = (struct pollfd*)alloca( poll_fd_count * sizeof( struct pollfd ));
@@ -1544,7 +1976,8 @@ static void *alsaMidiHandler( void *ptr )
   while ( data->doInput ) {
 
     if ( snd_seq_event_input_pending( apiData->seq, 1 ) == 0 ) {
-      // No data pending
+      // No data pending, the burst is complete.
+      alsaBatchFlush( data, &state );
       if ( poll( poll_fds, poll_fd_count, -1) >= 0 ) {
         if ( poll_fds[0].revents & POLLIN ) {
           bool dummy;
@@ -1567,148 +2000,10 @@ static void *alsaMidiHandler( void *ptr )
       continue;
     }
 
-    // This is a bit weird, but we now have to decode an ALSA MIDI
-    // event (back) into MIDI bytes.  We'll ignore non-MIDI types.
-    if ( !continueSysex ) message.bytes.clear();
-
-    doDecode = false;
-    switch ( ev->type ) {
-
-    case SND_SEQ_EVENT_PORT_SUBSCRIBED:
-#if defined(__RTMIDI_DEBUG__)
-      std::cout << "MidiInAlsa::alsaMidiHandler: port connection made!\n";
-#endif
-      break;
-
-    case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
-#if defined(__RTMIDI_DEBUG__)
-      std::cerr << "MidiInAlsa::alsaMidiHandler: port connection has closed!\n";
-      std::cout << "sender = " << (int) ev->data.connect.sender.client << ":"
-                << (int) ev->data.connect.sender.port
-                << ", dest = " << (int) ev->data.connect.dest.client << ":"
-                << (int) ev->data.connect.dest.port
-                << std::endl;
-#endif
-      break;
-
-    case SND_SEQ_EVENT_QFRAME: // MIDI time code
-      if ( !( data->ignoreFlags & 0x02 ) ) doDecode = true;
-      break;
-
-    case SND_SEQ_EVENT_TICK: // 0xF9 ... MIDI timing tick
-      if ( !( data->ignoreFlags & 0x02 ) ) doDecode = true;
-      break;
-
-    case SND_SEQ_EVENT_CLOCK: // 0xF8 ... MIDI timing (clock) tick
-      if ( !( data->ignoreFlags & 0x02 ) ) doDecode = true;
-      break;
-
-    case SND_SEQ_EVENT_SENSING: // Active sensing
-      if ( !( data->ignoreFlags & 0x04 ) ) doDecode = true;
-      break;
-
-    case SND_SEQ_EVENT_SYSEX:
-      if ( (data->ignoreFlags & 0x01) ) break;
-      if ( ev->data.ext.len > apiData->bufferSize ) {
-        apiData->bufferSize = ev->data.ext.len;
-        free( buffer );
-        buffer = (unsigned char *) malloc( apiData->bufferSize );
-        if ( buffer == NULL ) {
-          data->doInput = false;
-          std::cerr << "\nMidiInAlsa::alsaMidiHandler: error resizing buffer memory!\n\n";
-          break;
-        }
-      }
-      doDecode = true;
-      break;
-
-    default:
-      doDecode = true;
-    }
-
-    if ( doDecode ) {
-
-      nBytes = snd_midi_event_decode( apiData->coder, buffer, apiData->bufferSize, ev );
-      if ( nBytes > 0 ) {
-        // The ALSA sequencer has a maximum buffer size for MIDI sysex
-        // events of 256 bytes.  If a device sends sysex messages larger
-        // than this, they are segmented into 256 byte chunks.  So,
-        // we'll watch for this and concatenate sysex chunks into a
-        // single sysex message if necessary.
-        if ( !continueSysex )
-          message.bytes.assign( buffer, &buffer[nBytes] );
-        else
-          message.bytes.insert( message.bytes.end(), buffer, &buffer[nBytes] );
-
-        continueSysex = ( ( ev->type == SND_SEQ_EVENT_SYSEX ) && ( message.bytes.back() != 0xF7 ) );
-        if ( !continueSysex ) {
-
-          // Calculate the time stamp:
-          message.timeStamp = 0.0;
-
-          // Method 1: Use the system time.
-          //(void)gettimeofday(&tv, (struct timezone *)NULL);
-          //time = (tv.tv_sec * 1000000) + tv.tv_usec;
-
-          // Method 2: Use the ALSA sequencer event time data.
-          // (thanks to Pedro Lopez-Cabanillas!).
-
-          // Using method from:
-          // https://www.gnu.org/software/libc/manual/html_node/Elapsed-Time.html
-
-          // Perform the carry for the later subtraction by updating y.
-          // Temp var y is timespec because computation requires signed types,
-          // while snd_seq_real_time_t has unsigned types.
-          snd_seq_real_time_t &x( ev->time.time );
-          struct timespec y;
-          y.tv_nsec = apiData->lastTime.tv_nsec;
-          y.tv_sec = apiData->lastTime.tv_sec;
-          if ( x.tv_nsec < (unsigned int)y.tv_nsec ) {
-              int nsec = (y.tv_nsec - (int)x.tv_nsec) / 1000000000 + 1;
-              y.tv_nsec -= 1000000000 * nsec;
-              y.tv_sec += nsec;
-          }
-          if ( x.tv_nsec - y.tv_nsec > 1000000000 ) {
-              int nsec = ((int)x.tv_nsec - y.tv_nsec) / 1000000000;
-              y.tv_nsec += 1000000000 * nsec;
-              y.tv_sec -= nsec;
-          }
-
-          // Compute the time difference.
-          time = (int)x.tv_sec - y.tv_sec + ((int)x.tv_nsec - y.tv_nsec)*1e-9;
-
-          apiData->lastTime = ev->time.time;
-
-          if ( data->firstMessage == true )
-            data->firstMessage = false;
-          else
-            message.timeStamp = time;
-        }
-        else {
-#if defined(__RTMIDI_DEBUG__)
-          std::cerr << "\nMidiInAlsa::alsaMidiHandler: event parsing error or not a MIDI event!\n\n";
-#endif
-        }
-      }
-    }
-
-    snd_seq_free_event( ev );
-    if ( message.bytes.size() == 0 || continueSysex ) continue;
-
-    if ( data->usingCallback ) {
-      RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-      callback( message.timeStamp, &message.bytes, data->userData );
-    }
-    else {
-      // As long as we haven't reached our queue size limit, push the message.
-      if ( !data->queue.push( message ) )
-        std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
-    }
+    alsaInputEvent( data, &state, ev );
   }
 
-  if ( buffer ) free( buffer );
-  snd_midi_event_free( apiData->coder );
-  apiData->coder = 0;
+  alsaInputStop( data, &state );
   apiData->thread = apiData->dummy_thread_id;
   return 0;
 }
@@ -1726,13 +2021,14 @@ MidiInAlsa :: ~MidiInAlsa()
 
   // Shutdown the input thread.
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
-  if ( inputData_.doInput ) {
-    inputData_.doInput = false;
-    int res = write( data->trigger_fds[1], &inputData_.doInput, sizeof( inputData_.doInput ) );
-    (void) res;
-    if ( !pthread_equal(data->thread, data->dummy_thread_id) )
-      pthread_join( data->thread, NULL );
+  stopInput();
+
+  // Kernel routes belong to the clients they connect, they would outlive us.
+  if ( data->routeClient >= 0 ) {
+    for ( size_t i = 0; i < data->senders.size(); i++ )
+      alsaRoute( data, data->senders[i], false );
   }
+  pthread_mutex_destroy( &data->routeLock );
 
   // Cleanup.
   close ( data->trigger_fds[0] );
@@ -1769,6 +2065,14 @@ void MidiInAlsa :: initialize( const std::string& clientName )
   data->thread = data->dummy_thread_id;
   data->trigger_fds[0] = -1;
   data->trigger_fds[1] = -1;
+  data->external = false;
+  data->input = 0;
+  data->useCoder = false;
+  data->streamSysex = false;
+  data->sysexOpen = false;
+  data->routeClient = -1;
+  data->routePort = 0;
+  pthread_mutex_init( &data->routeLock, NULL );
   apiData_ = (void *) data;
   inputData_.apiData = (void *) data;
 
@@ -1824,6 +2128,50 @@ unsigned int portInfo( snd_seq_t *seq, snd_seq_port_info_t *pinfo, unsigned int
   return 0;
 }
 
+// Every MIDI port in a single walk over the clients, with the caps
+// portInfo() checks for input and output.
+static void alsaGetPorts( snd_seq_t *seq, std::vector<RtMidiPortInfo> &ports )
+{
+  const unsigned int inCaps = SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ;
+  const unsigned int outCaps = SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE;
+  snd_seq_client_info_t *cinfo;
+  snd_seq_port_info_t *pinfo;
+  int client;
+  snd_seq_client_info_alloca( &cinfo );
+  snd_seq_port_info_alloca( &pinfo );
+
+  ports.clear();
+  snd_seq_client_info_set_client( cinfo, -1 );
+  while ( snd_seq_query_next_client( seq, cinfo ) >= 0 ) {
+    client = snd_seq_client_info_get_client( cinfo );
+    if ( client == 0 ) continue;
+    snd_seq_port_info_set_client( pinfo, client );
+    snd_seq_port_info_set_port( pinfo, -1 );
+    while ( snd_seq_query_next_port( seq, pinfo ) >= 0 ) {
+      unsigned int atyp = snd_seq_port_info_get_type( pinfo );
+      if ( ( ( atyp & SND_SEQ_PORT_TYPE_MIDI_GENERIC ) == 0 ) &&
+           ( ( atyp & SND_SEQ_PORT_TYPE_SYNTH ) == 0 ) &&
+           ( ( atyp & SND_SEQ_PORT_TYPE_APPLICATION ) == 0 ) ) continue;
+
+      unsigned int caps = snd_seq_port_info_get_capability( pinfo );
+      RtMidiPortInfo info;
+      info.caps = 0;
+      if ( ( caps & inCaps ) == inCaps ) info.caps |= RtMidiPortInfo::CAN_INPUT;
+      if ( ( caps & outCaps ) == outCaps ) info.caps |= RtMidiPortInfo::CAN_OUTPUT;
+      if ( info.caps == 0 ) continue;
+      info.client = client;
+      info.port = snd_seq_port_info_get_port( pinfo );
+
+      // Same format as getPortName()
+      std::ostringstream os;
+      os << snd_seq_client_info_get_name( cinfo ) << ":" << snd_seq_port_info_get_name( pinfo )
+         << " " << info.client << ":" << info.port;
+      info.name = os.str();
+      ports.push_back( info );
+    }
+  }
+}
+
 unsigned int MidiInAlsa :: getPortCount()
 {
   snd_seq_port_info_t *pinfo;
@@ -1833,6 +2181,12 @@ unsigned int MidiInAlsa :: getPortCount()
   return portInfo( data->seq, pinfo, SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ, -1 );
 }
 
+void MidiInAlsa :: getPorts( std::vector<RtMidiPortInfo> &ports )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  alsaGetPorts( data->seq, ports );
+}
+
 std::string MidiInAlsa :: getPortName( unsigned int portNumber )
 {
   snd_seq_client_info_t *cinfo;
@@ -1954,8 +2308,7 @@ void MidiInAlsa :: openPort( unsigned int portNumber, const std::string &portNam
     pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_JOINABLE );
     pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
 
-    inputData_.doInput = true;
-    int err = pthread_create( &data->thread, &attr, alsaMidiHandler, &inputData_ );
+    int err = startInput( &attr );
     pthread_attr_destroy( &attr );
     if ( err ) {
       snd_seq_unsubscribe_port( data->seq, data->subscription );
@@ -2016,8 +2369,7 @@ void MidiInAlsa :: openVirtualPort( const std::string &portName )
     pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_JOINABLE );
     pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
 
-    inputData_.doInput = true;
-    int err = pthread_create( &data->thread, &attr, alsaMidiHandler, &inputData_ );
+    int err = startInput( &attr );
     pthread_attr_destroy( &attr );
     if ( err ) {
       if ( data->subscription ) {
@@ -2052,13 +2404,138 @@ void MidiInAlsa :: closePort( void )
   }
 
   // Stop thread to avoid triggering the callback, while the port is intended to be closed
+  stopInput();
+}
+
+// Starts the input thread, or with an external loop only the decoder
+// processEvents() runs. Returns 0 or the pthread_create() error.
+int MidiInAlsa :: startInput( pthread_attr_t *attr )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  inputData_.doInput = true;
+  if ( !data->external )
+    return pthread_create( &data->thread, attr, alsaMidiHandler, &inputData_ );
+
+  data->input = new AlsaInputState;
+  if ( !alsaInputStart( &inputData_, data->input ) ) {
+    delete data->input;
+    data->input = 0;
+    return -1;
+  }
+  return 0;
+}
+
+void MidiInAlsa :: stopInput( void )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( !inputData_.doInput ) return;
+  inputData_.doInput = false;
+  if ( data->input ) {
+    alsaInputStop( &inputData_, data->input );
+    delete data->input;
+    data->input = 0;
+    return;
+  }
+  int res = write( data->trigger_fds[1], &inputData_.doInput, sizeof( inputData_.doInput ) );
+  (void) res;
+  if ( !pthread_equal( data->thread, data->dummy_thread_id ) )
+    pthread_join( data->thread, NULL );
+}
+
+bool MidiInAlsa :: setKernelRoute( const RtMidiPortInfo &target )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( target.client < 0 || !( target.caps & RtMidiPortInfo::CAN_OUTPUT ) ) {
+    pthread_mutex_lock( &data->routeLock );
+    alsaClearRoute( data );
+    pthread_mutex_unlock( &data->routeLock );
+    errorString_ = "MidiInAlsa::setKernelRoute: the target is not an ALSA output port.";
+    error( RtMidiError::WARNING, errorString_ );
+    return false;
+  }
+
+  // From now on only control and program changes and the connection
+  // notifications the routes follow are delivered to this client.
+  snd_seq_set_client_event_filter( data->seq, SND_SEQ_EVENT_CONTROLLER );
+  snd_seq_set_client_event_filter( data->seq, SND_SEQ_EVENT_PGMCHANGE );
+  snd_seq_set_client_event_filter( data->seq, SND_SEQ_EVENT_PORT_SUBSCRIBED );
+  snd_seq_set_client_event_filter( data->seq, SND_SEQ_EVENT_PORT_UNSUBSCRIBED );
+
+  // Always redone: a target that came back at the same address lost
+  // its connections when it went away.
+  pthread_mutex_lock( &data->routeLock );
+  if ( data->routeClient >= 0 ) {
+    for ( size_t i = 0; i < data->senders.size(); i++ )
+      alsaRoute( data, data->senders[i], false );
+  }
+  data->routeClient = target.client;
+  data->routePort = target.port;
+  bool complete = true;
+  for ( size_t i = 0; i < data->senders.size() && complete; i++ )
+    complete = alsaRoute( data, data->senders[i], true ) >= 0;
+  if ( !complete ) // that sender's notes would be lost to the filter, everything comes through here again
+    alsaClearRoute( data );
+  pthread_mutex_unlock( &data->routeLock );
+  if ( !complete ) {
+    errorString_ = "MidiInAlsa::setKernelRoute: could not connect a sender to the target.";
+    error( RtMidiError::WARNING, errorString_ );
+  }
+  return complete;
+}
+
+bool MidiInAlsa :: setExternalLoop( bool external )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
   if ( inputData_.doInput ) {
-    inputData_.doInput = false;
-    int res = write( data->trigger_fds[1], &inputData_.doInput, sizeof( inputData_.doInput ) );
-    (void) res;
-    if ( !pthread_equal( data->thread, data->dummy_thread_id ) )
-      pthread_join( data->thread, NULL );
+    errorString_ = "MidiInAlsa::setExternalLoop: input is already running, close the port first.";
+    error( RtMidiError::WARNING, errorString_ );
+    return false;
   }
+  data->external = external;
+  return true;
+}
+
+bool MidiInAlsa :: setSysexStreaming( bool stream )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  data->streamSysex = stream;
+  return true;
+}
+
+int MidiInAlsa :: getPollDescriptors( int *fds, int maxFds )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  int count = snd_seq_poll_descriptors_count( data->seq, POLLIN );
+  struct pollfd *poll_fds = (struct pollfd*)alloca( count * sizeof( struct pollfd ));
+  count = snd_seq_poll_descriptors( data->seq, poll_fds, count, POLLIN );
+  if ( count > maxFds ) count = maxFds;
+  for ( int i = 0; i < count; i++ )
+    fds[i] = poll_fds[i].fd;
+  return count;
+}
+
+void MidiInAlsa :: processEvents( void )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  snd_seq_event_t *ev;
+  int result;
+  if ( !data->input ) return;
+
+  // Everything that is pending, the sequencer handle is non-blocking.
+  while ( inputData_.doInput && snd_seq_event_input_pending( data->seq, 1 ) > 0 ) {
+    result = snd_seq_event_input( data->seq, &ev );
+    if ( result == -ENOSPC ) {
+      std::cerr << "\nMidiInAlsa::processEvents: MIDI input buffer overrun!\n\n";
+      continue;
+    }
+    else if ( result <= 0 ) {
+      std::cerr << "\nMidiInAlsa::processEvents: unknown MIDI input error!\n";
+      perror("System reports");
+      break;
+    }
+    alsaInputEvent( &inputData_, data->input, ev );
+  }
+  alsaBatchFlush( &inputData_, data->input );
 }
 
 void MidiInAlsa :: setClientName( const std::string &clientName )
@@ -2125,6 +2602,11 @@ void MidiOutAlsa :: initialize( const std::string& clientName )
   data->bufferSize = 32;
   data->coder = 0;
   data->buffer = 0;
+  data->external = false;
+  data->input = 0;
+  data->useCoder = false;
+  data->streamSysex = false;
+  data->sysexOpen = false;
   int result = snd_midi_event_new( data->bufferSize, &data->coder );
   if ( result < 0 ) {
     delete data;
@@ -2152,6 +2634,12 @@ unsigned int MidiOutAlsa :: getPortCount()
   return portInfo( data->seq, pinfo, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE, -1 );
 }
 
+void MidiOutAlsa :: getPorts( std::vector<RtMidiPortInfo> &ports )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  alsaGetPorts( data->seq, ports );
+}
+
 std::string MidiOutAlsa :: getPortName( unsigned int portNumber )
 {
   snd_seq_client_info_t *cinfo;
@@ -2208,9 +2696,44 @@ void MidiOutAlsa :: openPort( unsigned int portNumber, const std::string &portNa
     return;
   }
 
+  subscribe( snd_seq_port_info_get_client( pinfo ), snd_seq_port_info_get_port( pinfo ), portName );
+}
+
+void MidiOutAlsa :: openPortAt( const RtMidiPortInfo &port, const std::string &portName )
+{
+  if ( port.client < 0 ) {
+    openPort( port.port, portName );
+    return;
+  }
+  if ( connected_ ) {
+    errorString_ = "MidiOutAlsa::openPortAt: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  // A single lookup of the address instead of a walk over all ports.
+  const unsigned int outCaps = SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE;
+  snd_seq_port_info_t *pinfo;
+  snd_seq_port_info_alloca( &pinfo );
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( snd_seq_get_any_port_info( data->seq, port.client, port.port, pinfo ) < 0 ||
+       ( snd_seq_port_info_get_capability( pinfo ) & outCaps ) != outCaps ) {
+    std::ostringstream ost;
+    ost << "MidiOutAlsa::openPortAt: no output port at " << port.client << ":" << port.port << ".";
+    errorString_ = ost.str();
+    error( RtMidiError::INVALID_PARAMETER, errorString_ );
+    return;
+  }
+
+  subscribe( port.client, port.port, portName );
+}
+
+void MidiOutAlsa :: subscribe( int client, int port, const std::string &portName )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
   snd_seq_addr_t sender, receiver;
-  receiver.client = snd_seq_port_info_get_client( pinfo );
-  receiver.port = snd_seq_port_info_get_port( pinfo );
+  receiver.client = client;
+  receiver.port = port;
   sender.client = snd_seq_client_id( data->seq );
 
   if ( data->vport < 0 ) {
@@ -2292,48 +2815,154 @@ void MidiOutAlsa :: openVirtualPort( const std::string &portName )
 }
 
 void MidiOutAlsa :: sendMessage( const unsigned char *message, size_t size )
+{
+  queueMessage( message, size );
+  flushMessages();
+}
+
+void MidiOutAlsa :: queueMessage( const unsigned char *message, size_t size )
+{
+  switch ( tryQueueMessage( message, size ) ) {
+  case RtMidiOut::SEND_ENCODE_ERROR:
+    errorString_ = "MidiOutAlsa::sendMessage: event parsing error!";
+    error( RtMidiError::WARNING, errorString_ );
+    break;
+  case RtMidiOut::SEND_WOULD_BLOCK:
+  case RtMidiOut::SEND_PORT_GONE:
+    errorString_ = "MidiOutAlsa::sendMessage: error sending MIDI message to port.";
+    error( RtMidiError::WARNING, errorString_ );
+    break;
+  default:
+    break;
+  }
+}
+
+void MidiOutAlsa :: flushMessages( void )
+{
+  tryFlushMessages();
+}
+
+// Fills ev for a complete channel voice or one byte system message, the
+// fields the coder would set. False for anything else, the coder
+// handles those (running status, partial messages, MTC, song position).
+static bool alsaSetShortEvent( snd_seq_event_t *ev, const unsigned char *m, unsigned int n )
+{
+  int channel = m[0] & 0x0F;
+  switch ( n == 3 ? m[0] & 0xF0 : 0 ) {
+  case 0x80: snd_seq_ev_set_noteoff( ev, channel, m[1], m[2] ); return true;
+  case 0x90: snd_seq_ev_set_noteon( ev, channel, m[1], m[2] ); return true;
+  case 0xA0: snd_seq_ev_set_keypress( ev, channel, m[1], m[2] ); return true;
+  case 0xB0: snd_seq_ev_set_controller( ev, channel, m[1], m[2] ); return true;
+  case 0xE0: snd_seq_ev_set_pitchbend( ev, channel, ( ( m[2] << 7 ) | m[1] ) - 8192 ); return true;
+  }
+  switch ( n == 2 ? m[0] & 0xF0 : 0 ) {
+  case 0xC0: snd_seq_ev_set_pgmchange( ev, channel, m[1] ); return true;
+  case 0xD0: snd_seq_ev_set_chanpress( ev, channel, m[1] ); return true;
+  }
+  if ( n != 1 ) return false;
+  switch ( m[0] ) {
+  case 0xF6: ev->type = SND_SEQ_EVENT_TUNE_REQUEST; break;
+  case 0xF8: ev->type = SND_SEQ_EVENT_CLOCK; break;
+  case 0xFA: ev->type = SND_SEQ_EVENT_START; break;
+  case 0xFB: ev->type = SND_SEQ_EVENT_CONTINUE; break;
+  case 0xFC: ev->type = SND_SEQ_EVENT_STOP; break;
+  case 0xFE: ev->type = SND_SEQ_EVENT_SENSING; break;
+  case 0xFF: ev->type = SND_SEQ_EVENT_RESET; break;
+  default: return false;
+  }
+  snd_seq_ev_set_fixed( ev );
+  return true;
+}
+
+void MidiOutAlsa :: setDirectEvents( bool direct )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  data->useCoder = !direct;
+}
+
+// Status for a negative ALSA result. Only errors that mean the sequencer
+// or the port is gone report SEND_PORT_GONE, an event the sequencer
+// refuses (-EINVAL for one larger than the output buffer, -ENOMEM) is
+// the message's fault and leaves the port up.
+static RtMidiOut::SendStatus alsaSendStatus( int result )
+{
+  switch ( result ) {
+  case -EAGAIN: return RtMidiOut::SEND_WOULD_BLOCK;
+  case -ENOENT:
+  case -ENXIO:
+  case -ENODEV:
+  case -EBADFD: return RtMidiOut::SEND_PORT_GONE;
+  default: return RtMidiOut::SEND_ENCODE_ERROR;
+  }
+}
+
+RtMidiOut::SendStatus MidiOutAlsa :: tryQueueMessage( const unsigned char *message, size_t size )
 {
   int result;
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( data->vport < 0 ) return countStatus( RtMidiOut::SEND_PORT_GONE );
   unsigned int nBytes = static_cast<unsigned int> (size);
-  if ( nBytes > data->bufferSize ) {
-    data->bufferSize = nBytes;
-    result = snd_midi_event_resize_buffer( data->coder, nBytes );
-    if ( result != 0 ) {
-      errorString_ = "MidiOutAlsa::sendMessage: ALSA error resizing MIDI event buffer.";
-      error( RtMidiError::DRIVER_ERROR, errorString_ );
-      return;
-    }
-    free (data->buffer);
-    data->buffer = (unsigned char *) malloc( data->bufferSize );
-    if ( data->buffer == NULL ) {
-      errorString_ = "MidiOutAlsa::initialize: error allocating buffer memory!\n\n";
-      error( RtMidiError::MEMORY_ERROR, errorString_ );
-      return;
-    }
-  }
 
   snd_seq_event_t ev;
   snd_seq_ev_clear( &ev );
   snd_seq_ev_set_source( &ev, data->vport );
   snd_seq_ev_set_subs( &ev );
   snd_seq_ev_set_direct( &ev );
-  for ( unsigned int i=0; i<nBytes; ++i ) data->buffer[i] = message[i];
-  result = snd_midi_event_encode( data->coder, data->buffer, (long)nBytes, &ev );
-  if ( result < (int)nBytes ) {
-    errorString_ = "MidiOutAlsa::sendMessage: event parsing error!";
-    error( RtMidiError::WARNING, errorString_ );
-    return;
+  bool direct = false;
+  // Part of a SysEx sent piece by piece: the start without its F7, or
+  // what follows it up to and including the F7. The coder cannot carry
+  // these, they always go out as they are.
+  bool piece = nBytes > 0 && ( message[0] == 0xF0 || ( data->sysexOpen && ( message[0] < 0x80 || message[0] == 0xF7 ) ) )
+               && !( message[0] == 0xF0 && message[nBytes - 1] == 0xF7 );
+  if ( piece || ( !data->useCoder && nBytes >= 2 && message[0] == 0xF0 && message[nBytes - 1] == 0xF7 ) ) {
+    // A SysEx frame needs no encoding, the event points at the caller's
+    // bytes until snd_seq_event_output_buffer() has copied them.
+    snd_seq_ev_set_sysex( &ev, nBytes, (void *) message );
+    direct = true;
+  }
+  else if ( !data->useCoder && nBytes > 0 )
+    direct = alsaSetShortEvent( &ev, message, nBytes ); // no buffer, no copy, no coder
+
+  if ( !direct ) {
+    if ( nBytes > data->bufferSize ) {
+      if ( snd_midi_event_resize_buffer( data->coder, nBytes ) != 0 )
+        return countStatus( RtMidiOut::SEND_ENCODE_ERROR );
+      unsigned char *buffer = (unsigned char *) malloc( nBytes );
+      if ( buffer == NULL )
+        return countStatus( RtMidiOut::SEND_ENCODE_ERROR );
+      free( data->buffer );
+      data->buffer = buffer;
+      data->bufferSize = nBytes;
+    }
+    for ( unsigned int i=0; i<nBytes; ++i ) data->buffer[i] = message[i];
+    result = snd_midi_event_encode( data->coder, data->buffer, (long)nBytes, &ev );
+    if ( result < (int)nBytes ) return countStatus( RtMidiOut::SEND_ENCODE_ERROR );
   }
 
-  // Send the event.
-  result = snd_seq_event_output( data->seq, &ev );
-  if ( result < 0 ) {
-    errorString_ = "MidiOutAlsa::sendMessage: error sending MIDI message to port.";
-    error( RtMidiError::WARNING, errorString_ );
-    return;
+  // Buffer the event, writing the buffer out first if it is full.
+  result = snd_seq_event_output_buffer( data->seq, &ev );
+  if ( result == -EAGAIN ) {
+    RtMidiOut::SendStatus status = tryFlushMessages();
+    if ( status != RtMidiOut::SEND_OK ) return status;
+    result = snd_seq_event_output_buffer( data->seq, &ev );
   }
-  snd_seq_drain_output( data->seq );
+  if ( result < 0 ) return countStatus( alsaSendStatus( result ) );
+  if ( piece )
+    data->sysexOpen = message[nBytes - 1] != 0xF7;
+  else if ( nBytes > 0 && message[0] < 0xF8 )
+    data->sysexOpen = false; // any status but realtime ends a SysEx on the wire
+  stats_.messages++;
+  return RtMidiOut::SEND_OK;
+}
+
+RtMidiOut::SendStatus MidiOutAlsa :: tryFlushMessages( void )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( snd_seq_event_output_pending( data->seq ) == 0 ) return RtMidiOut::SEND_OK;
+  stats_.writes++;
+  int result = snd_seq_drain_output( data->seq );
+  if ( result < 0 ) return countStatus( alsaSendStatus( result ) );
+  return RtMidiOut::SEND_OK;
 }
 
 #endif // __LINUX_ALSA__
@@ -2487,8 +3116,7 @@ static void CALLBACK midiInputCallback( HMIDIIN /*hmin*/,
   apiData->lastTime = timestamp;
 
   if ( data->usingCallback ) {
-    RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-    callback( apiData->message.timeStamp, &apiData->message.bytes, data->userData );
+    invokeCallback( data, apiData->message );
   }
   else {
     // As long as we haven't reached our queue size limit, push the message.
@@ -2845,12 +3473,27 @@ void MidiOutWinMM :: sendMessage( const unsigned char *message, size_t size )
 {
   if ( !connected_ ) return;
 
-  unsigned int nBytes = static_cast<unsigned int>(size);
-  if ( nBytes == 0 ) {
-    errorString_ = "MidiOutWinMM::sendMessage: message argument is empty!";
+  switch ( tryQueueMessage( message, size ) ) {
+  case RtMidiOut::SEND_ENCODE_ERROR:
+    errorString_ = "MidiOutWinMM::sendMessage: message is empty, larger than 3 bytes (and not sysex) or out of memory!";
     error( RtMidiError::WARNING, errorString_ );
-    return;
+    break;
+  case RtMidiOut::SEND_WOULD_BLOCK:
+  case RtMidiOut::SEND_PORT_GONE:
+    errorString_ = "MidiOutWinMM::sendMessage: error sending MIDI message.";
+    error( RtMidiError::DRIVER_ERROR, errorString_ );
+    break;
+  default:
+    break;
   }
+}
+
+RtMidiOut::SendStatus MidiOutWinMM :: tryQueueMessage( const unsigned char *message, size_t size )
+{
+  if ( !connected_ ) return countStatus( RtMidiOut::SEND_PORT_GONE );
+
+  unsigned int nBytes = static_cast<unsigned int>(size);
+  if ( nBytes == 0 ) return countStatus( RtMidiOut::SEND_ENCODE_ERROR );
 
   MMRESULT result;
   WinMidiData *data = static_cast<WinMidiData *> (apiData_);
@@ -2858,11 +3501,7 @@ void MidiOutWinMM :: sendMessage( const unsigned char *message, size_t size )
 
     // Allocate buffer for sysex data.
     char *buffer = (char *) malloc( nBytes );
-    if ( buffer == NULL ) {
-      errorString_ = "MidiOutWinMM::sendMessage: error allocating sysex message memory!";
-      error( RtMidiError::MEMORY_ERROR, errorString_ );
-      return;
-    }
+    if ( buffer == NULL ) return countStatus( RtMidiOut::SEND_ENCODE_ERROR );
 
     // Copy data to buffer.
     for ( unsigned int i=0; i<nBytes; ++i ) buffer[i] = message[i];
@@ -2875,18 +3514,14 @@ void MidiOutWinMM :: sendMessage( const unsigned char *message, size_t size )
     result = midiOutPrepareHeader( data->outHandle,  &sysex, sizeof( MIDIHDR ) );
     if ( result != MMSYSERR_NOERROR ) {
       free( buffer );
-      errorString_ = "MidiOutWinMM::sendMessage: error preparing sysex header.";
-      error( RtMidiError::DRIVER_ERROR, errorString_ );
-      return;
+      return countStatus( RtMidiOut::SEND_PORT_GONE );
     }
 
     // Send the message.
     result = midiOutLongMsg( data->outHandle, &sysex, sizeof( MIDIHDR ) );
     if ( result != MMSYSERR_NOERROR ) {
       free( buffer );
-      errorString_ = "MidiOutWinMM::sendMessage: error sending sysex message.";
-      error( RtMidiError::DRIVER_ERROR, errorString_ );
-      return;
+      return countStatus( RtMidiOut::SEND_PORT_GONE );
     }
 
     // Unprepare the buffer and MIDIHDR.
@@ -2896,11 +3531,7 @@ void MidiOutWinMM :: sendMessage( const unsigned char *message, size_t size )
   else { // Channel or system message.
 
     // Make sure the message size isn't too big.
-    if ( nBytes > 3 ) {
-      errorString_ = "MidiOutWinMM::sendMessage: message size is greater than 3 bytes (and not sysex)!";
-      error( RtMidiError::WARNING, errorString_ );
-      return;
-    }
+    if ( nBytes > 3 ) return countStatus( RtMidiOut::SEND_ENCODE_ERROR );
 
     // Pack MIDI bytes into double word.
     DWORD packet;
@@ -2912,11 +3543,11 @@ void MidiOutWinMM :: sendMessage( const unsigned char *message, size_t size )
 
     // Send the message immediately.
     result = midiOutShortMsg( data->outHandle, packet );
-    if ( result != MMSYSERR_NOERROR ) {
-      errorString_ = "MidiOutWinMM::sendMessage: error sending MIDI message.";
-      error( RtMidiError::DRIVER_ERROR, errorString_ );
-    }
+    if ( result != MMSYSERR_NOERROR ) return countStatus( RtMidiOut::SEND_PORT_GONE );
   }
+  stats_.messages++;
+  stats_.writes++;
+  return RtMidiOut::SEND_OK;
 }
 
 #endif  // __WINDOWS_MM__
@@ -3028,8 +3659,7 @@ static int jackProcessIn( jack_nframes_t nframes, void *arg )
       // If not a continuation of a SysEx message,
       // invoke the user callback function or queue the message.
       if ( rtData->usingCallback ) {
-        RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) rtData->userCallback;
-        callback( message.timeStamp, &message.bytes, rtData->userData );
+        invokeCallback( rtData, message );
       }
       else {
         // As long as we haven't reached our queue size limit, push the message.
@@ -3433,13 +4063,26 @@ void MidiOutJack :: setPortName( const std::string &portName )
 }
 
 void MidiOutJack :: sendMessage( const unsigned char *message, size_t size )
+{
+  if ( tryQueueMessage( message, size ) == RtMidiOut::SEND_WOULD_BLOCK ) {
+    errorString_ = "MidiOutJack::sendMessage: no room in the ring buffer, message dropped.";
+    error( RtMidiError::WARNING, errorString_ );
+  }
+}
+
+RtMidiOut::SendStatus MidiOutJack :: tryQueueMessage( const unsigned char *message, size_t size )
 {
   int nBytes = static_cast<int>(size);
   JackMidiData *data = static_cast<JackMidiData *> (apiData_);
 
-  // Write full message to buffer
+  // Write full message to buffer, or nothing if either ring is full
+  if ( jack_ringbuffer_write_space( data->buffMessage ) < size
+       || jack_ringbuffer_write_space( data->buffSize ) < sizeof( nBytes ) )
+    return countStatus( RtMidiOut::SEND_WOULD_BLOCK );
   jack_ringbuffer_write( data->buffMessage, ( const char * ) message, nBytes );
   jack_ringbuffer_write( data->buffSize, ( char * ) &nBytes, sizeof( nBytes ) );
+  stats_.messages++;
+  return RtMidiOut::SEND_OK;
 }
 
 #endif  // __UNIX_JACK__
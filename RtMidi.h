@@ -60,6 +60,7 @@
 
 #define RTMIDI_VERSION "4.0.0"
 
+#include <atomic>
 #include <exception>
 #include <iostream>
 #include <string>
@@ -130,6 +131,26 @@ protected:
  */
 typedef void (*RtMidiErrorCallback)(RtMidiError::Type type, const std::string &errorText, void *userData);
 
+//! One port as listed by RtMidi::getPorts().
+/*!
+    With the Linux ALSA API client:port is the sequencer address, which
+    stays valid until the client exits. The other APIs set client to -1
+    and port to the port number used by openPort().
+*/
+struct RtMidiPortInfo
+{
+  enum Caps
+  {
+    CAN_INPUT = 1, //!< can be opened by RtMidiIn
+    CAN_OUTPUT = 2 //!< can be opened by RtMidiOut
+  };
+
+  std::string name; //!< as returned by getPortName()
+  int client;
+  int port;
+  unsigned int caps; //!< Caps bits
+};
+
 class MidiApi;
 
 class RTMIDI_DLL_PUBLIC RtMidi
@@ -199,6 +220,14 @@ public:
   void setClientName(const std::string &clientName);
   void setPortName(const std::string &portName);
 
+  //! Fill ports with every available port in one pass.
+  /*!
+    Unlike getPortCount() and getPortName(), which walk the system once
+    per call, this walks it once in total. With the Linux ALSA API the
+    list holds input and output ports alike, check caps.
+  */
+  void getPorts(std::vector<RtMidiPortInfo> &ports);
+
   //! Returns true if a port is open and false if not.
   /*!
       Note that this only applies to connections made with the openPort()
@@ -255,13 +284,26 @@ public:
   //! User callback function type definition.
   typedef void (*RtMidiCallback)(double timeStamp, std::vector<unsigned char> *message, void *userData);
 
+  //! Callback that gets the bytes without a vector, timeStamp is in microseconds since the previous message.
+  typedef void (*RtMidiSpanCallback)(long long timeStamp, const unsigned char *bytes, size_t size, void *userData);
+
+  //! One message of a batch, bytes are only valid during the batch callback.
+  struct RtMidiInRecord {
+    double timeStamp;
+    const unsigned char *bytes;
+    size_t size;
+  };
+
+  //! Batch callback, gets every message that was pending in one call.
+  typedef void (*RtMidiBatchCallback)(const RtMidiInRecord *records, size_t count, void *userData);
+
   //! Default constructor that allows an optional api, client name and queue size.
   /*!
     An exception will be thrown if a MIDI system initialization
     error occurs.  The queue size defines the maximum number of
     messages that can be held in the MIDI queue (when not using a
-    callback function).  If the queue size limit is reached,
-    incoming messages will be ignored.
+    callback function), it is rounded up to a power of two.  If the
+    queue size limit is reached, incoming messages will be ignored.
 
     If no API argument is specified and multiple API support has been
     compiled, the default order of use is ALSA, JACK (Linux) and CORE,
@@ -316,6 +358,36 @@ public:
   */
   void setCallback(RtMidiCallback callback, void *userData = 0);
 
+  //! Set a callback function that receives a byte pointer and length instead of a vector.
+  /*!
+    Takes the place of setCallback(), only one of the two can be set,
+    cancelCallback() removes either. The bytes are only valid during
+    the call. With the Linux ALSA API messages that arrive in a single
+    sequencer event (everything but SysEx split into chunks) are given
+    straight from the decoder buffer of the input thread, without
+    touching a vector, and control changes are built from the parsed
+    sequencer event without the decoder. A batch callback, when set,
+    gets the messages instead.
+
+    \param userData Optionally, a pointer to additional data can be
+                    passed to the callback function whenever it is called.
+  */
+  void setSpanCallback(RtMidiSpanCallback callback, void *userData = 0);
+
+  //! Set a callback that gets all pending messages at once (Linux ALSA only).
+  /*!
+    With the Linux ALSA API every event already waiting in the
+    sequencer is decoded into one buffer and the whole burst is handed
+    over in a single call, in arrival order, instead of one message
+    callback per event. Timestamps are deltas as with the message
+    callback. While set it takes precedence over the span and message
+    callbacks and the queue, control changes are still built from the
+    parsed sequencer event without the decoder. The other APIs keep
+    using the span or message callback. Pass 0 to go back to one call
+    per message.
+  */
+  void setBatchCallback(RtMidiBatchCallback callback, void *userData = 0);
+
   //! Cancel use of the current callback function (if one exists).
   /*!
     Subsequent incoming MIDI messages will be written to the queue
@@ -374,10 +446,65 @@ public:
   */
   virtual void setErrorCallback(RtMidiErrorCallback errorCallback = NULL, void *userData = 0);
 
+  //! Run input from the application's own event loop instead of an input thread.
+  /*!
+    Must be called before a port is opened. The application polls the
+    descriptors from getPollDescriptors() for reading and calls
+    processEvents() when one is ready, the callback then runs inside
+    processEvents(). Only the Linux ALSA API supports this, the
+    function returns false for the other APIs.
+  */
+  bool setExternalLoop(bool external = true);
+
+  //! Deliver SysEx piece by piece as the sequencer receives it instead of reassembled (Linux ALSA only).
+  /*!
+    Each piece goes to the callback (or the queue) as soon as it
+    arrives, so a long dump is passed on while it is still coming in.
+    The first piece starts with 0xF0, the last one ends with 0xF7 and
+    the pieces in between carry neither. Realtime messages may arrive
+    between the pieces, anything else from the same sender only after
+    the last one. Should be set before a port is opened. Returns false
+    for the other APIs, which keep reassembling.
+  */
+  bool setSysexStreaming(bool stream = true);
+
+  //! Fill fds with up to maxFds descriptors to poll for input, returns the number filled.
+  int getPollDescriptors(int *fds, int maxFds);
+
+  //! Read and dispatch all pending input without blocking (external loop only).
+  void processEvents(void);
+
+  //! Have the sequencer deliver input straight to target, only control and program changes reach this process (Linux ALSA only).
+  /*!
+    Every port connected to this input is also connected to target, so
+    notes, clock and SysEx reach it without being decoded and encoded
+    again here, and the callback only sees control and program changes
+    (the latter so the application knows the target changed voice). The
+    sequencer routes whole connections: target gets both as well. Call again to move the routes to a new target.
+    Returns false for the other APIs, a target without an ALSA address or
+    a sender that cannot be connected to it. On ALSA a false return
+    removes any routes and the event filter, everything is delivered to
+    the callback again.
+  */
+  bool setKernelRoute(const RtMidiPortInfo &target);
+
 protected:
   void openMidiApi(RtMidi::Api api, const std::string &clientName, unsigned int queueSizeLimit);
 };
 
+//! Output counters, see RtMidiOut::getOutputStats().
+/*!
+    Only the Linux ALSA API keeps these, they stay 0 elsewhere.
+*/
+struct RtMidiOutStats
+{
+  unsigned long messages;     //!< messages handed to the driver
+  unsigned long writes;       //!< buffer writes to the driver, one system call each
+  unsigned long wouldBlock;   //!< SEND_WOULD_BLOCK results
+  unsigned long portGone;     //!< SEND_PORT_GONE results
+  unsigned long encodeErrors; //!< SEND_ENCODE_ERROR results
+};
+
 /**********************************************************************/
 /*! \class RtMidiOut
     \brief A realtime MIDI output class.
@@ -442,6 +569,9 @@ public:
   */
   void openVirtualPort(const std::string &portName = std::string("RtMidi Output"));
 
+  //! Open the port at a client:port address from getPorts(), without enumerating the ports again.
+  void openPort(const RtMidiPortInfo &port, const std::string &portName = std::string("RtMidi Output"));
+
   //! Return the number of available MIDI output ports.
   unsigned int getPortCount(void);
 
@@ -470,6 +600,55 @@ public:
   */
   void sendMessage(const unsigned char *message, size_t size);
 
+  //! Queue a message for output without writing it to the driver yet.
+  /*!
+      Queued messages go out in order with the next flushMessages() or
+      sendMessage() call, or earlier when the output buffer is full.
+      APIs without an output buffer send the message immediately.
+
+      \param message A pointer to the MIDI message as raw bytes
+      \param size    Length of the MIDI message in bytes
+  */
+  void queueMessage(const unsigned char *message, size_t size);
+
+  //! Write all messages queued with queueMessage() to the driver at once.
+  void flushMessages(void);
+
+  //! Return the output counters of this port.
+  RtMidiOutStats getOutputStats(void) const;
+
+  //! Choose whether complete messages bypass the MIDI byte encoder (Linux ALSA only, default true).
+  /*!
+    A complete SysEx message is sent as an event pointing at the
+    caller's bytes, a complete channel or realtime message is filled
+    into the event directly. Neither is copied into the encoder buffer
+    or run through the encoder. false sends everything through the
+    encoder, as a baseline for measurements.
+  */
+  void setDirectEvents(bool direct);
+
+  //! Result of the try*() output functions.
+  enum SendStatus {
+    SEND_OK,          /*!< The message was handed to the driver. */
+    SEND_WOULD_BLOCK, /*!< The driver has no room right now, nothing was sent. */
+    SEND_PORT_GONE,   /*!< No port to send from, or the driver or port went away. */
+    SEND_ENCODE_ERROR /*!< The driver cannot encode or take this message (e.g. too large), the port is fine. */
+  };
+
+  //! Like sendMessage(), but reports problems only through the returned status.
+  /*!
+      Never throws, does not call the error callback and does not print.
+      Every status other than SEND_OK is counted in getOutputStats().
+      No error strings are built either.
+  */
+  SendStatus trySendMessage(const unsigned char *message, size_t size);
+
+  //! queueMessage() with a status instead of errors, see trySendMessage().
+  SendStatus tryQueueMessage(const unsigned char *message, size_t size);
+
+  //! flushMessages() with a status instead of errors, see trySendMessage().
+  SendStatus tryFlushMessages(void);
+
   //! Set an error callback function to be invoked when an error has occured.
   /*!
     The callback function will be called whenever an error has occured. It is best
@@ -508,6 +687,7 @@ public:
 
   virtual unsigned int getPortCount(void) = 0;
   virtual std::string getPortName(unsigned int portNumber) = 0;
+  virtual void getPorts(std::vector<RtMidiPortInfo> &ports) = 0;
 
   inline bool isPortOpen() const { return connected_; }
   void setErrorCallback(RtMidiErrorCallback errorCallback, void *userData);
@@ -517,6 +697,7 @@ public:
 
 protected:
   virtual void initialize(const std::string &clientName) = 0;
+  void listPorts(std::vector<RtMidiPortInfo> &ports, unsigned int caps);
 
   void *apiData_;
   bool connected_;
@@ -533,8 +714,16 @@ public:
   virtual ~MidiInApi(void);
   void setCallback(RtMidiIn::RtMidiCallback callback, void *userData);
   void cancelCallback(void);
+  void setSpanCallback(RtMidiIn::RtMidiSpanCallback callback, void *userData);
+  void setBatchCallback(RtMidiIn::RtMidiBatchCallback callback, void *userData);
   virtual void ignoreTypes(bool midiSysex, bool midiTime, bool midiSense);
   double getMessage(std::vector<unsigned char> *message);
+  virtual bool setExternalLoop(bool external) { return !external; }
+  virtual bool setSysexStreaming(bool stream) { return !stream; }
+  virtual int getPollDescriptors(int *fds, int maxFds) { return 0; }
+  virtual void processEvents(void) {}
+  virtual bool setKernelRoute(const RtMidiPortInfo &target) { return false; }
+  virtual void getPorts(std::vector<RtMidiPortInfo> &ports) { listPorts(ports, RtMidiPortInfo::CAN_INPUT); }
 
   // A MIDI structure used internally by the class to store incoming
   // messages.  Each message represents one and only one MIDI message.
@@ -550,19 +739,40 @@ public:
         : bytes(0), timeStamp(0.0) {}
   };
 
+  // Wait-free ring from the input thread (push) to getMessage() (pop).
+  // Messages up to INLINE_BYTES are kept in their slot, longer ones in
+  // a byte ring (the slab) beside it, so neither side allocates. Both
+  // sizes are powers of two, the indices only grow and are masked on use.
   struct MidiQueue
   {
-    unsigned int front;
-    unsigned int back;
+    enum { INLINE_BYTES = 16 };
+    struct Slot
+    {
+      double timeStamp;
+      unsigned int size;
+      unsigned int offset; // where the bytes start in the slab if size > INLINE_BYTES
+      unsigned char bytes[INLINE_BYTES];
+    };
+
+    std::atomic<unsigned int> front; // written by the consumer only
+    std::atomic<unsigned int> back;  // written by the producer only
     unsigned int ringSize;
-    MidiMessage *ring;
+    Slot *ring;
+    std::atomic<unsigned int> slabFront; // consumer
+    unsigned int slabBack;               // producer
+    unsigned int slabSize;
+    unsigned char *slab;
 
     // Default constructor.
     MidiQueue()
-        : front(0), back(0), ringSize(0), ring(0) {}
+        : front(0), back(0), ringSize(0), ring(0), slabFront(0), slabBack(0), slabSize(0), slab(0) {}
+    ~MidiQueue();
+    // Room for at least limit messages, 0 for no queue.
+    void allocate(unsigned int limit);
     bool push(const MidiMessage &);
+    bool push(const unsigned char *bytes, size_t size, double timeStamp);
     bool pop(std::vector<unsigned char> *, double *);
-    unsigned int size(unsigned int *back = 0, unsigned int *front = 0);
+    unsigned int size(void) const;
   };
 
   // The RtMidiInData structure is used to pass private class data to
@@ -579,11 +789,14 @@ public:
     RtMidiIn::RtMidiCallback userCallback;
     void *userData;
     bool continueSysex;
+    RtMidiIn::RtMidiSpanCallback spanCallback;
+    RtMidiIn::RtMidiBatchCallback batchCallback;
+    void *batchUserData;
 
     // Default constructor.
     RtMidiInData()
         : ignoreFlags(7), doInput(false), firstMessage(true), apiData(0), usingCallback(false),
-          userCallback(0), userData(0), continueSysex(false) {}
+          userCallback(0), userData(0), continueSysex(false), spanCallback(0), batchCallback(0), batchUserData(0) {}
   };
 
 protected:
@@ -596,6 +809,19 @@ public:
   MidiOutApi(void);
   virtual ~MidiOutApi(void);
   virtual void sendMessage(const unsigned char *message, size_t size) = 0;
+  virtual void queueMessage(const unsigned char *message, size_t size) { sendMessage(message, size); }
+  virtual void flushMessages(void) {}
+  virtual void getPorts(std::vector<RtMidiPortInfo> &ports) { listPorts(ports, RtMidiPortInfo::CAN_OUTPUT); }
+  virtual void openPortAt(const RtMidiPortInfo &port, const std::string &portName) { openPort(port.port, portName); }
+  RtMidiOutStats getOutputStats(void) const { return stats_; }
+  virtual RtMidiOut::SendStatus tryQueueMessage(const unsigned char *message, size_t size) = 0;
+  virtual RtMidiOut::SendStatus tryFlushMessages(void);
+  virtual void setDirectEvents(bool direct) {}
+
+protected:
+  RtMidiOut::SendStatus countStatus(RtMidiOut::SendStatus status);
+
+  RtMidiOutStats stats_;
 };
 
 // **************************************************************** //
@@ -611,21 +837,40 @@ inline void RtMidiIn ::closePort(void) { rtapi_->closePort(); }
 inline bool RtMidiIn ::isPortOpen() const { return rtapi_->isPortOpen(); }
 inline void RtMidiIn ::setCallback(RtMidiCallback callback, void *userData) { static_cast<MidiInApi *>(rtapi_)->setCallback(callback, userData); }
 inline void RtMidiIn ::cancelCallback(void) { static_cast<MidiInApi *>(rtapi_)->cancelCallback(); }
+inline void RtMidiIn ::setSpanCallback(RtMidiSpanCallback callback, void *userData) { static_cast<MidiInApi *>(rtapi_)->setSpanCallback(callback, userData); }
+inline void RtMidiIn ::setBatchCallback(RtMidiBatchCallback callback, void *userData) { static_cast<MidiInApi *>(rtapi_)->setBatchCallback(callback, userData); }
 inline unsigned int RtMidiIn ::getPortCount(void) { return rtapi_->getPortCount(); }
 inline std::string RtMidiIn ::getPortName(unsigned int portNumber) { return rtapi_->getPortName(portNumber); }
 inline void RtMidiIn ::ignoreTypes(bool midiSysex, bool midiTime, bool midiSense) { static_cast<MidiInApi *>(rtapi_)->ignoreTypes(midiSysex, midiTime, midiSense); }
 inline double RtMidiIn ::getMessage(std::vector<unsigned char> *message) { return static_cast<MidiInApi *>(rtapi_)->getMessage(message); }
 inline void RtMidiIn ::setErrorCallback(RtMidiErrorCallback errorCallback, void *userData) { rtapi_->setErrorCallback(errorCallback, userData); }
+inline bool RtMidiIn ::setExternalLoop(bool external) { return static_cast<MidiInApi *>(rtapi_)->setExternalLoop(external); }
+inline bool RtMidiIn ::setSysexStreaming(bool stream) { return static_cast<MidiInApi *>(rtapi_)->setSysexStreaming(stream); }
+inline int RtMidiIn ::getPollDescriptors(int *fds, int maxFds) { return static_cast<MidiInApi *>(rtapi_)->getPollDescriptors(fds, maxFds); }
+inline void RtMidiIn ::processEvents(void) { static_cast<MidiInApi *>(rtapi_)->processEvents(); }
+inline bool RtMidiIn ::setKernelRoute(const RtMidiPortInfo &target) { return static_cast<MidiInApi *>(rtapi_)->setKernelRoute(target); }
 
 inline RtMidi::Api RtMidiOut ::getCurrentApi(void) throw() { return rtapi_->getCurrentApi(); }
 inline void RtMidiOut ::openPort(unsigned int portNumber, const std::string &portName) { rtapi_->openPort(portNumber, portName); }
 inline void RtMidiOut ::openVirtualPort(const std::string &portName) { rtapi_->openVirtualPort(portName); }
+inline void RtMidiOut ::openPort(const RtMidiPortInfo &port, const std::string &portName) { static_cast<MidiOutApi *>(rtapi_)->openPortAt(port, portName); }
 inline void RtMidiOut ::closePort(void) { rtapi_->closePort(); }
 inline bool RtMidiOut ::isPortOpen() const { return rtapi_->isPortOpen(); }
 inline unsigned int RtMidiOut ::getPortCount(void) { return rtapi_->getPortCount(); }
 inline std::string RtMidiOut ::getPortName(unsigned int portNumber) { return rtapi_->getPortName(portNumber); }
 inline void RtMidiOut ::sendMessage(const std::vector<unsigned char> *message) { static_cast<MidiOutApi *>(rtapi_)->sendMessage(&message->at(0), message->size()); }
 inline void RtMidiOut ::sendMessage(const unsigned char *message, size_t size) { static_cast<MidiOutApi *>(rtapi_)->sendMessage(message, size); }
+inline void RtMidiOut ::queueMessage(const unsigned char *message, size_t size) { static_cast<MidiOutApi *>(rtapi_)->queueMessage(message, size); }
+inline void RtMidiOut ::flushMessages(void) { static_cast<MidiOutApi *>(rtapi_)->flushMessages(); }
+inline RtMidiOutStats RtMidiOut ::getOutputStats(void) const { return static_cast<MidiOutApi *>(rtapi_)->getOutputStats(); }
+inline void RtMidiOut ::setDirectEvents(bool direct) { static_cast<MidiOutApi *>(rtapi_)->setDirectEvents(direct); }
+inline RtMidiOut::SendStatus RtMidiOut ::tryQueueMessage(const unsigned char *message, size_t size) { return static_cast<MidiOutApi *>(rtapi_)->tryQueueMessage(message, size); }
+inline RtMidiOut::SendStatus RtMidiOut ::tryFlushMessages(void) { return static_cast<MidiOutApi *>(rtapi_)->tryFlushMessages(); }
+inline RtMidiOut::SendStatus RtMidiOut ::trySendMessage(const unsigned char *message, size_t size)
+{
+  SendStatus status = tryQueueMessage(message, size);
+  return status == SEND_OK ? tryFlushMessages() : status;
+}
 inline void RtMidiOut ::setErrorCallback(RtMidiErrorCallback errorCallback, void *userData) { rtapi_->setErrorCallback(errorCallback, userData); }
 
 #endif
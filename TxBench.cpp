@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "RtMidi.h"
+#include "TxBench.h"
+#include "TxOut.h"
+
+// batch 1 uses sendMessage(), otherwise queueMessage() with a flush every batch messages.
+static void benchPath(RtMidiOut &out, const char *name, int count, int batch)
+{
+    unsigned char m[7] = {0xF0, 0x43, 0x10, 0x12, 0x00, 0x00, 0xF7};
+    RtMidiOutStats before = out.getOutputStats();
+    long long start = nowUs();
+    for (int i = 0; i < count; i++)
+    {
+        m[4] = i % 77;
+        m[5] = i % 100;
+        if (batch <= 1)
+            out.sendMessage(m, sizeof(m));
+        else
+        {
+            out.queueMessage(m, sizeof(m));
+            if ((i + 1) % batch == 0)
+                out.flushMessages();
+        }
+    }
+    out.flushMessages();
+    long long us = std::max(nowUs() - start, 1LL);
+    RtMidiOutStats after = out.getOutputStats();
+    unsigned long writes = after.writes - before.writes;
+    std::cout << name << ": " << count << " messages in " << us / 1000.0 << " ms, " << (long long)(count * 1000000.0 / us)
+              << " msg/s, " << (double)writes / count << " writes per message" << std::endl;
+}
+
+// Same message count through the encoder and the direct event path.
+static void benchEncoding(RtMidiOut &out, const char *name, const std::vector<unsigned char> &m, int count)
+{
+    for (int direct = 0; direct < 2; direct++)
+    {
+        out.setDirectEvents(direct != 0);
+        long long start = nowUs();
+        for (int i = 0; i < count; i++)
+            out.sendMessage(m.data(), m.size());
+        long long us = std::max(nowUs() - start, 1LL);
+        std::cout << name << (direct ? ", direct " : ", encoder") << ": " << count << " messages in " << us / 1000.0
+                  << " ms, " << (long long)(count * 1000000.0 / us) << " msg/s, "
+                  << (long long)(count * (double)m.size() / us) << " MB/s" << std::endl;
+    }
+    out.setDirectEvents(true);
+}
+
+void runBench(int count)
+{
+    if (count <= 0)
+        count = 10000;
+    RtMidiOut out;
+    out.openVirtualPort("DX4OPBENCH");
+    benchPath(out, "sendMessage      ", count, 1);
+    benchPath(out, "queue, flush x16 ", count, 16);
+    benchPath(out, "queue, flush x256", count, 256);
+
+    std::vector<unsigned char> param = {0xF0, 0x43, 0x10, 0x12, 0x05, 0x40, 0xF7};
+    benchEncoding(out, "7 byte parameter change", param, count);
+
+    // DX7 32 voice bulk dump: F0 43 0n 09 20 00, 4096 data bytes, checksum, F7
+    std::vector<unsigned char> bulk(4104, 0);
+    const unsigned char head[6] = {0xF0, 0x43, 0x00, 0x09, 0x20, 0x00};
+    std::copy(head, head + 6, bulk.begin());
+    for (int i = 0; i < 4096; i++)
+        bulk[6 + i] = i % 100;
+    unsigned char sum = 0;
+    for (int i = 0; i < 4096; i++)
+        sum += bulk[6 + i];
+    bulk[4102] = (128 - (sum & 0x7F)) & 0x7F;
+    bulk[4103] = 0xF7;
+    benchEncoding(out, "4104 byte DX7 bulk dump", bulk, std::max(count / 100, 10));
+}
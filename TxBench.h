@@ -0,0 +1,14 @@
+/*******************************************************************
+-bench N: pushes N parameter changes through a virtual output port
+with the one write per message path and with batched writes, and
+prints throughput and driver writes per message for each. Then
+compares the MIDI encoder with the direct event path on 7 byte
+parameter changes and 4104 byte DX7 bulk dumps.
+Nothing needs to be connected to the port.
+*******************************************************************/
+#ifndef TXBENCH_H
+#define TXBENCH_H
+
+void runBench(int count);
+
+#endif
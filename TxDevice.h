@@ -0,0 +1,164 @@
+/*******************************************************************
+Device description for the SysEx parameter change targets txSex can
+drive: the DX7 voice (6-op) and the TX81Z VCED/ACED/PCED blocks (4-op).
+
+Everything here is constexpr so that the CC map in TxMap.h can be
+checked against it at compile time. Data ranges follow the TX81Z
+parameter tables at the top of main.cpp and the DX7 VCED table.
+*******************************************************************/
+#ifndef TXDEVICE_H
+#define TXDEVICE_H
+
+// Third byte of a parameter change frame: 0ggggghh (group/subgroup).
+// The tables in main.cpp write ggggg/hh out in binary, these are the
+// resulting byte values. DX7 splits its 156 voice parameters over two
+// groups, parameters 128-155 are sent as group 1, parameter 0-27.
+enum SYX_GROUPS
+{
+    DX7_VOICE = 0x00,
+    DX7_VOICE_HI = 0x01,
+    PCED = 0x10,
+    VCED = 0x12,
+    ACED = 0x13 // also carries the remote switches (parameters 64-75)
+};
+
+struct PARAM_RANGE
+{
+    int MIN;
+    int MAX;
+    constexpr bool valid() const { return MIN <= MAX; }
+};
+
+constexpr PARAM_RANGE NO_PARAM = {1, 0};
+constexpr PARAM_RANGE ASCII_PARAM = {32, 127};
+
+constexpr PARAM_RANGE dx7Range(int p)
+{
+    if (p < 0 || p > 155)
+        return NO_PARAM;
+    if (p < 126) // 6 operators x 21 parameters, op 6 first
+    {
+        const int OP_MAX[21] = {99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 3, 3, 7, 3, 7, 99, 1, 31, 99, 14};
+        return {0, OP_MAX[p % 21]};
+    }
+    if (p < 134) // pitch EG rates and levels
+        return {0, 99};
+    if (p >= 145 && p <= 154) // voice name
+        return ASCII_PARAM;
+    switch (p)
+    {
+    case 134: return {0, 31}; // algorithm
+    case 135: return {0, 7};  // feedback
+    case 136: return {0, 1};  // osc key sync
+    case 141: return {0, 1};  // LFO sync
+    case 142: return {0, 5};  // LFO wave
+    case 143: return {0, 7};  // pitch mod sensitivity
+    case 144: return {0, 48}; // transpose
+    case 155: return {0, 63}; // operator on/off
+    default: return {0, 99};  // LFO speed, delay, PMD, AMD
+    }
+}
+
+constexpr PARAM_RANGE vcedRange(int p)
+{
+    if (p < 0 || p > 93)
+        return NO_PARAM;
+    if (p < 52) // 4 operators x 13 parameters, op 4 first
+    {
+        const int OP_MAX[13] = {31, 31, 31, 15, 15, 99, 3, 7, 1, 7, 99, 63, 6};
+        return {p % 13 == 3 ? 1 : 0, OP_MAX[p % 13]};
+    }
+    if (p >= 77 && p <= 86) // voice name
+        return ASCII_PARAM;
+    if (p >= 87 && p <= 92) // unused
+        return NO_PARAM;
+    switch (p)
+    {
+    case 52: return {0, 7};   // algorithm
+    case 53: return {0, 7};   // feedback
+    case 58: return {0, 1};   // LFO sync
+    case 59: return {0, 3};   // LFO wave
+    case 60: return {0, 7};   // pitch mod sensitivity
+    case 61: return {0, 3};   // amplitude mod sensitivity
+    case 62: return {0, 48};  // transpose
+    case 63: return {0, 1};   // poly/mono
+    case 64: return {0, 12};  // pitch bend range
+    case 65: return {0, 1};   // portamento mode
+    case 68: return {0, 1};   // sustain
+    case 69: return {0, 1};   // portamento
+    case 70: return {0, 0};   // chorus (not used)
+    case 93: return {0, 15};  // operator on/off
+    default: return {0, 99};
+    }
+}
+
+constexpr PARAM_RANGE acedRange(int p)
+{
+    if (p < 0)
+        return NO_PARAM;
+    if (p < 20) // 4 operators x 5 parameters, op 4 first
+    {
+        const int OP_MAX[5] = {1, 7, 15, 7, 3};
+        return {0, OP_MAX[p % 5]};
+    }
+    if (p == 20) // reverb rate
+        return {0, 7};
+    if (p <= 22) // FC pitch, FC amplitude
+        return {0, 99};
+    if (p >= 64 && p <= 75) // remote switches, 0 = off, 127 = on
+        return {0, 127};
+    return NO_PARAM;
+}
+
+constexpr PARAM_RANGE pcedRange(int p)
+{
+    if (p < 0 || p > 109)
+        return NO_PARAM;
+    if (p < 96) // 8 instruments x 12 parameters
+    {
+        const int INST_MAX[12] = {8, 127, 127, 16, 127, 127, 14, 48, 99, 3, 3, 1};
+        return {0, INST_MAX[p % 12]};
+    }
+    if (p >= 100) // performance name
+        return ASCII_PARAM;
+    const int PERF_MAX[4] = {12, 1, 3, 11}; // micro tune table, assign mode, effect, key
+    return {0, PERF_MAX[p - 96]};
+}
+
+// Valid data range for a parameter change, NO_PARAM if the group or
+// parameter number does not exist.
+constexpr PARAM_RANGE paramRange(int group, int parameter)
+{
+    switch (group)
+    {
+    case DX7_VOICE: return parameter > 127 ? NO_PARAM : dx7Range(parameter);
+    case DX7_VOICE_HI: return parameter > 27 ? NO_PARAM : dx7Range(parameter + 128);
+    case VCED: return vcedRange(parameter);
+    case ACED: return acedRange(parameter);
+    case PCED: return pcedRange(parameter);
+    default: return NO_PARAM;
+    }
+}
+
+// Single voice bulk dumps: F0 43 0n FORMAT cc cc PREFIX data checksum F7.
+// cc cc is the 14 bit byte count of PREFIX and data, the checksum is the
+// two's complement of their sum. Data byte i holds parameter i of GROUP
+// (DX7 parameters 128-154 are sent as DX7_VOICE_HI in parameter changes).
+// The TX81Z resets ACED when it gets a VCED dump alone, a full voice is
+// the ACED dump followed by the VCED dump.
+struct BULK_FORMAT
+{
+    unsigned char FORMAT;
+    int GROUP;
+    int COUNT;          // data bytes
+    const char *PREFIX; // ACED data starts with a 10 character signature
+    int PREFIX_SIZE;
+};
+
+constexpr BULK_FORMAT VCED_BULK = {0x03, VCED, 93, "", 0};
+constexpr BULK_FORMAT ACED_BULK = {0x7E, ACED, 23, "LM  8976AE", 10};
+constexpr BULK_FORMAT DX7_BULK = {0x00, DX7_VOICE, 155, "", 0};
+
+constexpr int bulkSize(const BULK_FORMAT &f) { return 8 + f.PREFIX_SIZE + f.COUNT; }
+
+#endif
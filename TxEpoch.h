@@ -0,0 +1,106 @@
+/*******************************************************************
+Epoch based publication of an object that one thread replaces while
+others use it, here the hardware RtMidiOut: the main thread opens a
+new port on reconnect and swaps it in, the output thread keeps
+writing without a lock and never sees a port being closed under it.
+
+Readers pin the current epoch with enter() and let go with leave().
+The writer publishes a new object and retires the old one, which is
+only deleted once every reader has moved past the epoch it was
+retired in. One writer thread, READERS reader slots.
+*******************************************************************/
+#ifndef TXEPOCH_H
+#define TXEPOCH_H
+
+#include <atomic>
+#include <thread>
+
+template <typename T, unsigned int READERS = 1>
+class EPOCH_PTR
+{
+public:
+    EPOCH_PTR() : ptr(0), epoch(1), nRetired(0)
+    {
+        for (unsigned int i = 0; i < READERS; i++)
+            pinned[i].store(IDLE, std::memory_order_relaxed);
+    }
+
+    ~EPOCH_PTR()
+    {
+        for (unsigned int i = 0; i < nRetired; i++)
+            delete retired[i].OBJ;
+        delete ptr.load();
+    }
+
+    // Reader side, never blocks. The object stays valid until leave().
+    T *enter(unsigned int reader)
+    {
+        pinned[reader].store(epoch.load(std::memory_order_acquire), std::memory_order_seq_cst);
+        return ptr.load(std::memory_order_seq_cst);
+    }
+
+    void leave(unsigned int reader) { pinned[reader].store(IDLE, std::memory_order_release); }
+
+    // Writer side. Makes next current (0 to clear), the old object is
+    // deleted as soon as no reader can hold it any more.
+    void publish(T *next)
+    {
+        T *old = ptr.exchange(next, std::memory_order_seq_cst);
+        // a reader that loaded old pinned an epoch <= e before loading it
+        unsigned long e = epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (old)
+        {
+            while (nRetired == RETIRED && reclaim() == RETIRED)
+                std::this_thread::yield(); // only a reader stuck inside enter()/leave() holds this up
+            retired[nRetired].OBJ = old;
+            retired[nRetired].EPOCH = e;
+            nRetired++;
+        }
+        reclaim();
+    }
+
+    // Writer side: the current object without pinning, only the writer deletes.
+    T *current() const { return ptr.load(std::memory_order_acquire); }
+
+    // Deletes retired objects no reader can reach, returns how many are left.
+    unsigned int reclaim()
+    {
+        unsigned long oldest = IDLE;
+        for (unsigned int i = 0; i < READERS; i++)
+        {
+            unsigned long p = pinned[i].load(std::memory_order_seq_cst);
+            if (p < oldest)
+                oldest = p;
+        }
+        unsigned int kept = 0;
+        for (unsigned int i = 0; i < nRetired; i++)
+        {
+            if (retired[i].EPOCH < oldest)
+                delete retired[i].OBJ;
+            else
+                retired[kept++] = retired[i];
+        }
+        nRetired = kept;
+        return nRetired;
+    }
+
+private:
+    static const unsigned long IDLE = ~0UL;
+    enum
+    {
+        RETIRED = 8
+    };
+    struct RETIREE
+    {
+        T *OBJ;
+        unsigned long EPOCH; // last epoch a reader could have picked OBJ up in
+    };
+
+    std::atomic<T *> ptr;
+    std::atomic<unsigned long> epoch;
+    std::atomic<unsigned long> pinned[READERS]; // epoch each reader is in, IDLE outside
+    RETIREE retired[RETIRED];
+    unsigned int nRetired;
+};
+
+#endif
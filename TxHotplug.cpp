@@ -0,0 +1,131 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "TxHotplug.h"
+
+#if defined(__LINUX_ALSA__)
+#include <alsa/asoundlib.h>
+#endif
+
+PORT_WATCH::PORT_WATCH() : seq(0)
+{
+    kick[0] = kick[1] = -1;
+}
+
+PORT_WATCH::~PORT_WATCH()
+{
+#if defined(__LINUX_ALSA__)
+    if (seq)
+        snd_seq_close(static_cast<snd_seq_t *>(seq));
+#endif
+    if (kick[0] >= 0)
+    {
+        close(kick[0]);
+        close(kick[1]);
+    }
+}
+
+bool PORT_WATCH::open()
+{
+#if defined(__LINUX_ALSA__)
+    snd_seq_t *s;
+    if (snd_seq_open(&s, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0)
+        return false;
+    snd_seq_set_client_name(s, "txSex Watch");
+    int port = snd_seq_create_simple_port(s, "Announce", SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT,
+                                          SND_SEQ_PORT_TYPE_APPLICATION);
+    if (port < 0 || snd_seq_connect_from(s, port, SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE) < 0 || pipe(kick) < 0)
+    {
+        snd_seq_close(s);
+        return false;
+    }
+    fcntl(kick[0], F_SETFL, O_NONBLOCK);
+    fcntl(kick[1], F_SETFL, O_NONBLOCK);
+    seq = s;
+    return true;
+#else
+    return false;
+#endif
+}
+
+int PORT_WATCH::wait(int timeoutMs)
+{
+#if defined(__LINUX_ALSA__)
+    snd_seq_t *s = static_cast<snd_seq_t *>(seq);
+    if (!s)
+        return WATCH_NONE;
+    struct pollfd fds[8];
+    int n = snd_seq_poll_descriptors(s, fds, 7, POLLIN);
+    fds[n].fd = kick[0];
+    fds[n].events = POLLIN;
+    if (poll(fds, n + 1, timeoutMs) <= 0)
+        return WATCH_NONE;
+    return read();
+#else
+    return WATCH_NONE;
+#endif
+}
+
+int PORT_WATCH::descriptors(int *fds, int max) const
+{
+    int n = 0;
+#if defined(__LINUX_ALSA__)
+    snd_seq_t *s = static_cast<snd_seq_t *>(seq);
+    if (!s || max < 2)
+        return 0;
+    struct pollfd p[8];
+    n = snd_seq_poll_descriptors(s, p, max - 1 < 7 ? max - 1 : 7, POLLIN);
+    for (int i = 0; i < n; i++)
+        fds[i] = p[i].fd;
+    fds[n++] = kick[0];
+#endif
+    return n;
+}
+
+int PORT_WATCH::read()
+{
+    int events = WATCH_NONE;
+#if defined(__LINUX_ALSA__)
+    snd_seq_t *s = static_cast<snd_seq_t *>(seq);
+    if (!s)
+        return events;
+    char drain[16];
+    bool kicked = false;
+    while (::read(kick[0], drain, sizeof(drain)) > 0)
+        kicked = true;
+    if (kicked)
+        events |= WATCH_KICKED;
+    snd_seq_event_t *ev;
+    int result;
+    while ((result = snd_seq_event_input(s, &ev)) >= 0)
+    {
+        switch (ev->type)
+        {
+        case SND_SEQ_EVENT_CLIENT_START:
+        case SND_SEQ_EVENT_PORT_START:
+            events |= WATCH_APPEARED;
+            break;
+        case SND_SEQ_EVENT_CLIENT_EXIT:
+        case SND_SEQ_EVENT_PORT_EXIT:
+            events |= WATCH_VANISHED;
+            break;
+        case SND_SEQ_EVENT_CLIENT_CHANGE:
+        case SND_SEQ_EVENT_PORT_CHANGE:
+            events |= WATCH_APPEARED | WATCH_VANISHED;
+            break;
+        }
+    }
+    if (result == -ENOSPC) // input overran, announcements were lost
+        events |= WATCH_APPEARED | WATCH_VANISHED;
+#endif
+    return events;
+}
+
+void PORT_WATCH::wake()
+{
+    if (kick[1] >= 0)
+    {
+        char c = 1;
+        (void)!write(kick[1], &c, 1);
+    }
+}
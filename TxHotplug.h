@@ -0,0 +1,51 @@
+/*******************************************************************
+Port hotplug from the ALSA sequencer's System:Announce port (0:1).
+A separate sequencer client listens to client/port start, exit and
+change announcements, so the hardware port is reopened as soon as it
+appears instead of on the next 30 second poll.
+
+Linux ALSA only. Elsewhere open() fails and main() keeps polling.
+*******************************************************************/
+#ifndef TXHOTPLUG_H
+#define TXHOTPLUG_H
+
+// Bits returned by PORT_WATCH::wait().
+enum WATCH_EVENTS
+{
+    WATCH_NONE = 0,
+    WATCH_APPEARED = 1, // a client or port started or changed
+    WATCH_VANISHED = 2, // a client or port exited or changed
+    WATCH_KICKED = 4    // wake() was called
+};
+
+class PORT_WATCH
+{
+public:
+    PORT_WATCH();
+    ~PORT_WATCH();
+
+    // Subscribes to the announce port, false if that is not possible.
+    bool open();
+    bool isOpen() const { return seq != 0; }
+
+    // Blocks until announcements arrive, wake() is called or timeoutMs
+    // passes (-1 waits forever). Returns the WATCH_EVENTS seen, all
+    // pending announcements are consumed.
+    int wait(int timeoutMs);
+
+    // For an outside poll loop: fills fds with up to max descriptors
+    // (the wake() pipe included) and returns how many.
+    int descriptors(int *fds, int max) const;
+
+    // Consumes whatever is pending without blocking, returns the WATCH_EVENTS seen.
+    int read();
+
+    // Makes wait() return, from any thread.
+    void wake();
+
+private:
+    void *seq; // snd_seq_t, opaque so this header does not need ALSA
+    int kick[2];
+};
+
+#endif
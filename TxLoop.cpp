@@ -0,0 +1,103 @@
+#include "TxLoop.h"
+
+#if defined(__linux__)
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
+EVENT_LOOP::EVENT_LOOP() : epfd(-1), timerfd(-1), sigfd(-1)
+{
+}
+
+EVENT_LOOP::~EVENT_LOOP()
+{
+#if defined(__linux__)
+    if (sigfd >= 0)
+        close(sigfd);
+    if (timerfd >= 0)
+        close(timerfd);
+    if (epfd >= 0)
+        close(epfd);
+#endif
+}
+
+bool EVENT_LOOP::open()
+{
+#if defined(__linux__)
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        return false;
+    // nowUs() reads steady_clock, which is CLOCK_MONOTONIC on Linux
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd < 0 || !add(&timerfd, 1, LOOP_TIMER))
+        return false;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigfd < 0 || !add(&sigfd, 1, LOOP_SIGNAL))
+        return false;
+    return sigprocmask(SIG_BLOCK, &mask, 0) == 0; // last, a failed open() leaves the signal handlers working
+#else
+    return false;
+#endif
+}
+
+bool EVENT_LOOP::add(const int *fds, int n, int tag)
+{
+#if defined(__linux__)
+    for (int i = 0; i < n; i++)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = tag;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0)
+            return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void EVENT_LOOP::arm(long long dueUs)
+{
+#if defined(__linux__)
+    struct itimerspec t = {};
+    if (dueUs >= 0)
+    {
+        if (dueUs == 0) // a zero it_value disarms, anything in the past fires at once
+            dueUs = 1;
+        t.it_value.tv_sec = dueUs / 1000000;
+        t.it_value.tv_nsec = (dueUs % 1000000) * 1000;
+    }
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &t, 0);
+#endif
+}
+
+int EVENT_LOOP::wait()
+{
+    int events = LOOP_NONE;
+#if defined(__linux__)
+    struct epoll_event ready[16];
+    int n = epoll_wait(epfd, ready, 16, -1);
+    for (int i = 0; i < n; i++)
+        events |= ready[i].data.u32;
+    if (events & LOOP_TIMER)
+    {
+        unsigned long long expired;
+        (void)!read(timerfd, &expired, sizeof(expired));
+    }
+    if (events & LOOP_SIGNAL)
+    {
+        struct signalfd_siginfo si;
+        while (read(sigfd, &si, sizeof(si)) == sizeof(si))
+            ;
+    }
+#endif
+    return events;
+}
@@ -0,0 +1,47 @@
+/*******************************************************************
+Single threaded runtime for -epoll. One epoll set carries the MIDI
+input descriptors, the hotplug watcher, a timerfd for paced output
+and a signalfd for SIGINT/SIGTERM, so translation, output and
+shutdown all run on the main thread with no hand-off between threads.
+
+Linux only. Elsewhere open() fails and main() keeps its threads.
+*******************************************************************/
+#ifndef TXLOOP_H
+#define TXLOOP_H
+
+// Bits returned by EVENT_LOOP::wait(), the tag given to add().
+enum LOOP_EVENTS
+{
+    LOOP_NONE = 0,
+    LOOP_TIMER = 1,  // the time given to arm() has come
+    LOOP_SIGNAL = 2, // SIGINT or SIGTERM
+    LOOP_INPUT = 4,
+    LOOP_HOTPLUG = 8
+};
+
+class EVENT_LOOP
+{
+public:
+    EVENT_LOOP();
+    ~EVENT_LOOP();
+
+    // Creates the epoll set, the timer and the signal descriptor. SIGINT
+    // and SIGTERM are blocked from here on and only arrive as LOOP_SIGNAL.
+    bool open();
+
+    // Watches fds for reading, wait() reports them as tag.
+    bool add(const int *fds, int n, int tag);
+
+    // Fires LOOP_TIMER at dueUs on the nowUs() clock, -1 disarms.
+    void arm(long long dueUs);
+
+    // Blocks until something is ready, returns the LOOP_EVENTS seen.
+    int wait();
+
+private:
+    int epfd;
+    int timerfd;
+    int sigfd;
+};
+
+#endif
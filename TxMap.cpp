@@ -0,0 +1,43 @@
+#include <cmath>
+#include "TxMap.h"
+
+unsigned char VALUE_LUT[128][128];
+
+// Maps x in 0..1 onto 0..1 along the given curve.
+static double shape(int curve, double x)
+{
+    const double k = 9.0; // log10(1 + 9x) style curves
+    switch (curve)
+    {
+    case CURVE_LOG:
+        return std::log1p(k * x) / std::log1p(k);
+    case CURVE_EXP:
+        return (std::pow(1.0 + k, x) - 1.0) / k;
+    default:
+        return x;
+    }
+}
+
+void buildLuts()
+{
+    for (int cc = 0; cc < 128; cc++)
+    {
+        const CC_FRAME &F = FRAMES.F[cc];
+        int range = F.MAX - F.MIN;
+        int curve = F.CURVE & ~CURVE_INV;
+        if (curve == CURVE_AUTO)
+            curve = range < 16 ? CURVE_STEP : CURVE_LIN;
+        for (int v = 0; v < 128; v++)
+        {
+            int in = (F.CURVE & CURVE_INV) ? 127 - v : v;
+            int out;
+            if (curve == CURVE_STEP)
+                out = in * (range + 1) / 128;
+            else
+                out = (int)std::lround(shape(curve, in / 127.0) * range);
+            if (out > range)
+                out = range;
+            VALUE_LUT[cc][v] = (unsigned char)(F.MIN + out);
+        }
+    }
+}
@@ -0,0 +1,265 @@
+/*******************************************************************
+CC -> SysEx map and its pre-encoded frame table.
+
+MAP[] is indexed by incoming CC number. SYSEX entries name a parameter
+change target (GROUP/PARAMETER, see TxDevice.h) and the data range the
+CC value is scaled to. At compile time every entry is checked against
+the device description and turned into a 7 byte frame template, so the
+hot path only has to patch in the data byte. The data byte itself comes
+from VALUE_LUT, a 128 entry table per CC built by buildLuts() at startup.
+*******************************************************************/
+#ifndef TXMAP_H
+#define TXMAP_H
+
+#include <utility>
+#include "TxDevice.h"
+
+enum BPOS
+{
+    GROUP = 3,
+    PARAMETER = 4,
+    DATA = 5
+
+};
+enum CCTYPES
+{
+    SYSTEM,
+    SYSEX,
+    SKIP,
+    CC
+};
+
+// How the 0-127 CC value is spread over MIN..MAX. CURVE_INV can be or'ed
+// onto any of the others to turn the knob around.
+enum CURVES
+{
+    CURVE_AUTO = 0, // CURVE_STEP for ranges of up to 16 values, CURVE_LIN otherwise
+    CURVE_LIN = 1,  // full knob travel covers MIN..MAX
+    CURVE_LOG = 2,  // fine resolution at the top of the range
+    CURVE_EXP = 3,  // fine resolution at the bottom of the range
+    CURVE_STEP = 4, // equal width knob segments per value, for switches and waveforms
+    CURVE_INV = 0x10
+};
+
+struct CC_MAPPING
+{
+    constexpr CC_MAPPING(CCTYPES TYPE, int CC, int MIN, int MAX, int GROUP, int PARAMETER, int CURVE = CURVE_AUTO) : TYPE(TYPE), CC(CC), MIN(MIN), MAX(MAX), GROUP(GROUP), PARAMETER(PARAMETER), CURVE(CURVE){};
+    CCTYPES TYPE = SKIP;
+    int CC = 0;
+    int MIN = 0;
+    int MAX = 99;
+    int GROUP = 0;
+    int PARAMETER = 0;
+    int CURVE = CURVE_AUTO;
+};
+//note - 4 op synths use the VCED/ACED groups (0x12/0x13), DX7 uses groups 0 and 1
+//an optional 7th value picks the knob curve, e.g. {SYSEX, 17, 0, 99, VCED, 66, CURVE_EXP}
+constexpr CC_MAPPING MAP[128] = {
+    {SYSEX, 0, 0, 1, VCED, 63},  //0  Poly Mono mode
+    {SYSEX, 1, 0, 48, VCED, 62}, // 1 Transpose
+    {CC, 2, 0, 127, 0, 0},       // breath
+    {SYSEX, 3, 0, 99, VCED, 54}, // 3 LFO SPEED
+    {CC, 4, 0, 127, 0, 0},       // Foot
+    {CC, 5, 0, 127, 0, 0},       // Portamento
+    {SYSEX, 6, 0, 99, VCED, 55}, // LFO DELAY
+    {CC, 7, 0, 127, 0, 0},       // 7 Volume
+    {SYSEX, 8, 0, 99, VCED, 56}, // 8 LFO PMD
+    {SYSEX, 9, 0, 99, VCED, 57}, // 9 LFO AMD
+    {CC, 10, 0, 127, 0, 0},      // 10 PAN
+    {SYSEX, 11, 0, 12, VCED, 64},// 11  Pitch Bend Range
+    {SYSEX, 12, 0, 3, VCED, 59}, // 12 LFO WAVE
+    {SYSEX, 13, 0, 1, VCED, 58}, // 13 LFO Sync
+    {SYSEX, 14, 0, 7, VCED, 60}, // 14 LFO PMS
+    {SYSEX, 15, 0, 3, VCED, 61}, // 15 LFO AMS
+    {SYSEX, 16, 0, 1, VCED, 65}, // 16 Portamento Mode
+    {SYSEX, 17, 0, 99, VCED, 66},// 17 Portamento Time
+    {SYSEX, 18, 0, 99, VCED, 67},// 18 FC Volume
+    {SYSEX, 19, 0, 1, VCED, 68}, // 19 Sustain
+    {SYSEX, 20, 0, 1, VCED, 69}, // 20 Portamento
+    {SYSEX, 21, 0, 99, 0, 84},   // 21 Mod Wheel  Pitch
+    {SYSEX, 22, 0, 99, 0, 63},   // 22 Mod Wheel Amplitude
+    {SYSEX, 23, 0, 99, 0, 42},   // 23 a Rate op4
+    {SYSEX, 24, 0, 99, 0, 21},   // 24
+    {SYSEX, 25, 0, 99, 0, 0},    // 25 op6
+    {SYSEX, 26, 0, 99, 0, 106},  // 26 Decay op1
+    {SYSEX, 27, 0, 99, 0, 85},   // 27
+    {SYSEX, 28, 0, 99, 0, 64},   // 28
+    {SYSEX, 29, 0, 99, 0, 43},   // 29
+    {SYSEX, 30, 0, 99, 0, 22},   // 30
+    {SYSEX, 31, 0, 99, 0, 1},    // 1
+    {SYSEX, 32, 0, 99, 0, 107},  // Sus op1
+    {SYSEX, 33, 0, 99, 0, 86},   // 1
+    {SYSEX, 34, 0, 99, 0, 65},   // 1
+    {SYSEX, 35, 0, 99, 0, 44},   // 1
+    {SYSEX, 36, 0, 99, 0, 23},   // 1
+    {SYSEX, 37, 0, 99, 0, 2},    // 1
+    {SYSEX, 38, 0, 99, 0, 108},  // 1 REl op1
+    {SYSEX, 39, 0, 99, 0, 87},   // 1
+    {SYSEX, 40, 0, 99, 0, 66},   // 1
+    {SYSEX, 41, 0, 99, 0, 45},   // 1
+    {SYSEX, 42, 0, 99, 0, 24},   // 1
+    {SYSEX, 43, 0, 99, 0, 3},    //
+    {SYSEX, 44, 0, 31, 0, 123},  // 1 Coarse op1
+    {SYSEX, 45, 0, 31, 0, 102},  // 1
+    {SYSEX, 46, 0, 31, 0, 81},   // 1
+    {SYSEX, 47, 0, 31, 0, 60},   // 1
+    {SYSEX, 48, 0, 31, 0, 39},   // 1
+    {SYSEX, 49, 0, 31, 0, 18},   // 1
+    {SYSEX, 50, 0, 99, 0, 124},  // 1 Fine Op1
+    {SYSEX, 51, 0, 99, 0, 103},  // 1
+    {SYSEX, 52, 0, 99, 0, 82},   // 1
+    {SYSEX, 53, 0, 99, 0, 61},   // 1
+    {SYSEX, 54, 0, 99, 0, 40},   // 1
+    {SYSEX, 55, 0, 99, 0, 19},   // 1
+    {SKIP, 56, 0, 127, 0, 0},    // 1
+    {SKIP, 57, 0, 127, 0, 0},    // 1
+    {SKIP, 58, 0, 127, 0, 0},    // 1
+    {SKIP, 59, 0, 127, 0, 0},    // 1
+    {SKIP, 60, 0, 127, 0, 0},    // 1
+    {SKIP, 61, 0, 127, 0, 0},    // 1
+    {SKIP, 62, 0, 127, 0, 0},    // 1
+    {SKIP, 63, 0, 127, 0, 0},    // 1
+    {CC, 64, 0, 127, 0, 0},      // Sustain
+    {SKIP, 65, 0, 127, 0, 0},    // 1
+    {CC, 66, 0, 127, 0, 0},      // Sostenuto
+    {SKIP, 67, 0, 127, 0, 0},    // 1
+    {SKIP, 68, 0, 127, 0, 0},    // 1
+    {SKIP, 69, 0, 127, 0, 0},    // 1
+    {SKIP, 70, 0, 127, 0, 0},    // 1
+    {CC, 71, 0, 127, 0, 0},      // 1 Resonane For Dexed -
+    {SKIP, 72, 0, 127, 0, 0},    // 1
+    {SYSEX, 73, 0, 48, 1, 16},   // Transpose
+    {CC, 74, 0, 127, 0, 0},      // Curoff for Dexed Midi Learn - not required 
+    {SYSEX, 75, 0, 7, 1, 7},     // Feedback
+    {SYSEX, 76, 0, 31, 1, 6},    // Algorithm
+    {SKIP, 77, 0, 127, 0, 0},    // 1
+    {SYSEX, 78, 0, 99, 0, 109},  // Atk level 1
+    {SYSEX, 79, 0, 99, 0, 110},  //  dc 1 lvl 1
+    {SYSEX, 80, 0, 99, 0, 111},  // sus lvl 1
+    {SYSEX, 81, 0, 99, 0, 112},  // rel lvl 1
+    {SYSEX, 82, 0, 99, 0, 88},   // a lvl 2
+    {SYSEX, 83, 0, 99, 0, 89},   // 1
+    {SYSEX, 84, 0, 99, 0, 90},   // 1
+    {SYSEX, 85, 0, 99, 0, 91},   // 1
+    {SYSEX, 86, 0, 99, 0, 67},   // op3
+    {SYSEX, 87, 0, 99, 0, 68},   // 1
+    {SYSEX, 88, 0, 99, 0, 69},   // 1
+    {SYSEX, 89, 0, 99, 0, 70},   // 1
+    {SYSEX, 90, 0, 99, 0, 46},   // op 4
+    {SYSEX, 91, 0, 99, 0, 47},   // 1
+    {SYSEX, 92, 0, 99, 0, 48},   // 1
+    {SYSEX, 93, 0, 99, 0, 49},   // 1
+    {SYSEX, 94, 0, 99, 0, 25},   // op5
+    {SYSEX, 95, 0, 99, 0, 26},   // 1
+    {SYSEX, 96, 0, 99, 0, 27},   // 1
+    {SYSEX, 97, 0, 99, 0, 28},   // 1
+    {SYSEX, 98, 0, 99, 0, 4},    // op6
+    {SYSEX, 99, 0, 99, 0, 5},    // 1
+    {SYSEX, 100, 0, 99, 0, 6},   // 1
+    {SYSEX, 101, 0, 99, 0, 7},   // 1
+    {SYSEX, 102, 0, 99, 0, 121}, // op level 1
+    {SYSEX, 103, 0, 99, 0, 100}, // 1
+    {SYSEX, 104, 0, 99, 0, 79},  // 1
+    {SYSEX, 105, 0, 99, 0, 58},  // 1
+    {SYSEX, 106, 0, 99, 0, 37},  // 1
+    {SYSEX, 107, 0, 99, 0, 16},  // 1
+    {SKIP, 108, 0, 127, 0, 0},   // 1
+    {SKIP, 109, 0, 127, 0, 0},   // 1
+    {SKIP, 110, 0, 127, 0, 0},   // 1
+    {SKIP, 111, 0, 127, 0, 0},   // 1
+    {SKIP, 112, 0, 127, 0, 0},   // 1
+    {SKIP, 113, 0, 127, 0, 0},   // 1
+    {SKIP, 114, 0, 127, 0, 0},   // 1
+    {SKIP, 115, 0, 127, 0, 0},   // 1
+    {SKIP, 116, 0, 127, 0, 0},   // 1
+    {SKIP, 117, 0, 127, 0, 0},   // 1
+    {SKIP, 118, 0, 127, 0, 0},   // 1
+    {SKIP, 119, 0, 127, 0, 0},   // 1
+    {SYSTEM, 120, 0, 127, 0, 0}, // 1
+    {SYSTEM, 121, 0, 127, 0, 0}, // 1
+    {SYSTEM, 122, 0, 127, 0, 0}, // 1
+    {SYSTEM, 123, 0, 127, 0, 0}, // 1
+    {SYSTEM, 124, 0, 127, 0, 0}, // 1
+    {SYSTEM, 125, 0, 127, 0, 0}, // 1
+    {SYSTEM, 126, 0, 127, 0, 0}, // 1
+    {SYSTEM, 127, 0, 127, 0, 0}, // 1
+
+};
+
+// One MAP entry, ready to send. SYX is F0 43 1n gg pp 00 F7 with only
+// the data byte left to fill in. 16 bytes so four entries share a cache line.
+struct alignas(16) CC_FRAME
+{
+    unsigned char SYX[8];
+    unsigned char TYPE;
+    unsigned char CC;
+    unsigned char MIN;
+    unsigned char MAX;
+    unsigned char CURVE;
+};
+
+struct FRAME_TABLE
+{
+    CC_FRAME F[128];
+};
+
+constexpr unsigned char BASE_SYX[7] = {0xF0, 0x43, 0x10, 0, 0, 0, 0xF7};
+
+constexpr bool mappingValid(const CC_MAPPING &m)
+{
+    if (m.CC < 0 || m.CC > 127 || m.MIN > m.MAX)
+        return false;
+    if ((m.CURVE & ~CURVE_INV) > CURVE_STEP)
+        return false;
+    if (m.TYPE != SYSEX)
+        return m.MIN >= 0 && m.MAX <= 127;
+    PARAM_RANGE r = paramRange(m.GROUP, m.PARAMETER);
+    return r.valid() && m.MIN >= r.MIN && m.MAX <= r.MAX;
+}
+
+// A bad entry fails the build here, the error names the offending CC
+// as MAP_CHECK<n>.
+template <int I>
+struct MAP_CHECK
+{
+    static_assert(mappingValid(MAP[I]), "MAP entry is outside the device parameter ranges (see TxDevice.h)");
+    static constexpr bool OK = true;
+};
+
+template <int... I>
+constexpr bool checkMap(std::integer_sequence<int, I...>)
+{
+    bool ok[] = {MAP_CHECK<I>::OK...};
+    for (bool b : ok)
+        if (!b)
+            return false;
+    return true;
+}
+static_assert(checkMap(std::make_integer_sequence<int, 128>()), "MAP check failed");
+
+constexpr FRAME_TABLE buildFrames(const CC_MAPPING (&map)[128])
+{
+    FRAME_TABLE t{};
+    for (int i = 0; i < 128; i++)
+    {
+        CC_FRAME &f = t.F[i];
+        for (int b = 0; b < 7; b++)
+            f.SYX[b] = BASE_SYX[b];
+        f.SYX[BPOS::GROUP] = (unsigned char)map[i].GROUP;
+        f.SYX[BPOS::PARAMETER] = (unsigned char)map[i].PARAMETER;
+        f.TYPE = (unsigned char)map[i].TYPE;
+        f.CC = (unsigned char)map[i].CC;
+        f.MIN = (unsigned char)map[i].MIN;
+        f.MAX = (unsigned char)map[i].MAX;
+        f.CURVE = (unsigned char)map[i].CURVE;
+    }
+    return t;
+}
+
+constexpr FRAME_TABLE FRAMES = buildFrames(MAP);
+
+// Parameter value for every (CC, CC value) pair, filled by buildLuts().
+extern unsigned char VALUE_LUT[128][128];
+void buildLuts();
+
+#endif
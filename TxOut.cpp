@@ -0,0 +1,554 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include "TxOut.h"
+#include "TxDevice.h"
+
+SYX_CACHE::SYX_CACHE() : SENT(0), DROPPED(0)
+{
+    for (int d = 0; d < DEVICES; d++)
+        nUnflushed[d] = 0;
+}
+
+bool SYX_CACHE::admit(int device, const unsigned char *m, size_t size)
+{
+    TX_SHADOW &synth = SYNTH[device];
+    if (isParamChange(m, size))
+    {
+        int key = paramKey(m);
+        if (key >= 0 && synth.value(key) == m[5])
+        {
+            DROPPED++;
+            return false;
+        }
+        if (key >= 0)
+        {
+            SENT++;
+            unflushed(device, key);
+        }
+    }
+    const BULK_FORMAT *f = bulkFormat(m, size);
+    if (f)
+        for (int i = 0; i < f->COUNT; i++)
+            unflushed(device, bulkKey(*f, m[2] & 0x0F, i));
+    synth.apply(m, size);
+    return true;
+}
+
+void SYX_CACHE::unflushed(int device, int key)
+{
+    if (nUnflushed[device] < UNFLUSHED_MAX)
+        UNFLUSHED[device][nUnflushed[device]] = key;
+    nUnflushed[device]++;
+}
+
+void SYX_CACHE::rollback(int device)
+{
+    if (nUnflushed[device] > UNFLUSHED_MAX)
+        SYNTH[device].forget();
+    else
+        for (unsigned int i = 0; i < nUnflushed[device]; i++)
+            if (SYNTH[device].at(UNFLUSHED[device][i]))
+                *SYNTH[device].at(UNFLUSHED[device][i]) = TX_SHADOW::UNKNOWN;
+    nUnflushed[device] = 0;
+}
+
+void SYX_CACHE::forget(int device)
+{
+    SYNTH[device].forget();
+}
+
+void SYX_CACHE::forget(int device, const unsigned char *m, size_t size)
+{
+    TX_SHADOW &synth = SYNTH[device];
+    const BULK_FORMAT *f = bulkFormat(m, size);
+    if (f)
+        for (int i = 0; i < f->COUNT; i++)
+            *synth.at(bulkKey(*f, m[2] & 0x0F, i)) = TX_SHADOW::UNKNOWN;
+    else if (isParamChange(m, size) && synth.at(paramKey(m)))
+        *synth.at(paramKey(m)) = TX_SHADOW::UNKNOWN;
+}
+
+CC_HYSTERESIS::CC_HYSTERESIS() : WIDTH(0), DROPPED(0)
+{
+    memset(LAST, -1, sizeof(LAST));
+    memset(DIR, 0, sizeof(DIR));
+}
+
+bool CC_HYSTERESIS::admit(int channel, int cc, int value)
+{
+    if (WIDTH <= 0)
+        return true;
+    signed char &last = LAST[channel & 0x0F][cc & 0x7F];
+    signed char &dir = DIR[channel & 0x0F][cc & 0x7F];
+    int delta = value - last;
+    if (last >= 0)
+    {
+        if (delta == 0)
+        {
+            DROPPED++;
+            return false;
+        }
+        bool sameWay = (delta > 0) == (dir > 0);
+        bool end = value == 0 || value == 127;
+        if (dir != 0 && !sameWay && !end && (delta < 0 ? -delta : delta) <= WIDTH)
+        {
+            DROPPED++;
+            return false;
+        }
+    }
+    dir = last < 0 ? 0 : (delta > 0 ? 1 : -1);
+    last = (signed char)value;
+    return true;
+}
+
+PARAM_COALESCER::PARAM_COALESCER() : BOUND_US(0), MERGED(0), nHeld(0)
+{
+    for (int k = 0; k < PARAM_KEYS; k++)
+        LAST_US[k] = -1000000000LL;
+    memset(PENDING, NONE, sizeof(PENDING));
+}
+
+bool PARAM_COALESCER::submit(const unsigned char *m, size_t size, long long now)
+{
+    if (!isParamChange(m, size))
+        return false;
+    int key = paramKey(m);
+    if (key < 0)
+        return false;
+    if (PENDING[key] == NONE)
+    {
+        HELD[nHeld++] = key;
+        DUE_US[key] = std::max(now, LAST_US[key] + BOUND_US);
+    }
+    else
+        MERGED++;
+    PENDING[key] = m[5];
+    return true;
+}
+
+int PARAM_COALESCER::peek(long long now, bool force) const
+{
+    for (int i = 0; i < nHeld; i++)
+        if (force || DUE_US[HELD[i]] <= now)
+            return HELD[i];
+    return -1;
+}
+
+void PARAM_COALESCER::take(int key, long long now)
+{
+    if (PENDING[key] == NONE)
+        return;
+    PENDING[key] = NONE;
+    LAST_US[key] = now;
+    int i = std::find(HELD, HELD + nHeld, key) - HELD;
+    memmove(&HELD[i], &HELD[i + 1], (nHeld - i - 1) * sizeof(int));
+    nHeld--;
+}
+
+bool PARAM_COALESCER::pop(long long now, unsigned char *m, bool force)
+{
+    int key = peek(now, force);
+    if (key < 0)
+        return false;
+    paramFrame(key, PENDING[key], m);
+    take(key, now);
+    return true;
+}
+
+long long PARAM_COALESCER::nextDue() const
+{
+    long long due = -1;
+    for (int i = 0; i < nHeld; i++)
+    {
+        long long t = DUE_US[HELD[i]];
+        if (due < 0 || t < due)
+            due = t;
+    }
+    return due;
+}
+
+int laneOf(const unsigned char *m, size_t size)
+{
+    if (size == 0)
+        return LANE_NOTE;
+    if (m[0] >= 0xF8)
+        return LANE_REALTIME;
+    if (m[0] == 0xF0)
+        return LANE_SYSEX;
+    switch (m[0] & 0xF0)
+    {
+    case 0xB0:
+    case 0xC0:
+        return LANE_CC;
+    default:
+        return LANE_NOTE;
+    }
+}
+
+OUT_SCHEDULER::OUT_SCHEDULER()
+    : BACKLOG_US(3000), BARRIERS(0), CACHE(0), DEVICE(DEV_VIRTUAL), BULKS(0), BULK_PARAMS(0), STREAM_TIMEOUT_US(1000000),
+      STREAMED(0), STREAM_ABORTS(0), HOLD_DROPPED(0), ccHead(0), ccTail(0), wireFree(0), streaming(false), streamUs(0),
+      holdUsed(0)
+{
+    for (int l = 0; l < LANES; l++)
+        SENT[l] = 0;
+    for (int c = 0; c < 16; c++)
+        for (int k = 0; k < 128; k++)
+            CC_AT[c][k] = NO_CC;
+}
+
+// Sends the oldest queued CC.
+void OUT_SCHEDULER::emitCC(long long now, SEND_FN send)
+{
+    unsigned int pos = ccHead++;
+    CC_RECORD &r = CCQ[pos & (CC_RING - 1)];
+    unsigned int &at = CC_AT[r.M[0] & 0x0F][r.M[1] & 0x7F];
+    if (at == pos)
+        at = NO_CC;
+    emit(r.M, r.SIZE, LANE_CC, now, send);
+}
+
+void OUT_SCHEDULER::emit(const unsigned char *m, size_t size, int lane, long long now, SEND_FN send)
+{
+    if (!send(m, size))
+        return;
+    wireFree = std::max(wireFree, now) + (long long)size * DIN_BYTE_US;
+    SENT[lane]++;
+}
+
+void OUT_SCHEDULER::hold(const unsigned char *m, size_t size)
+{
+    if (size > 0xFFFF || holdUsed + 2 + size > HOLD_BYTES)
+    {
+        HOLD_DROPPED++;
+        return;
+    }
+    HOLD[holdUsed] = size >> 8;
+    HOLD[holdUsed + 1] = size & 0xFF;
+    memcpy(&HOLD[holdUsed + 2], m, size);
+    holdUsed += 2 + size;
+}
+
+void OUT_SCHEDULER::endStream(long long now, SEND_FN send, bool abort)
+{
+    if (abort)
+    {
+        static const unsigned char EOX = 0xF7;
+        emit(&EOX, 1, LANE_SYSEX, now, send);
+        STREAM_ABORTS++;
+    }
+    streaming = false;
+    // A held SysEx may start the next stream, what follows it stays held.
+    size_t off = 0;
+    while (off < holdUsed && !streaming)
+    {
+        size_t size = HOLD[off] << 8 | HOLD[off + 1];
+        off += 2;
+        push(&HOLD[off], size, now, send);
+        off += size;
+    }
+    memmove(HOLD, HOLD + off, holdUsed - off);
+    holdUsed -= off;
+}
+
+void OUT_SCHEDULER::push(const unsigned char *m, size_t size, long long now, SEND_FN send)
+{
+    int lane = laneOf(m, size);
+    bool noteOn = size == 3 && (m[0] & 0xF0) == 0x90 && m[2] > 0;
+    bool noteOff = size == 3 && ((m[0] & 0xF0) == 0x80 || ((m[0] & 0xF0) == 0x90 && m[2] == 0));
+    bool program = size >= 2 && (m[0] & 0xF0) == 0xC0;
+    if (streaming)
+    {
+        if (lane == LANE_REALTIME) // allowed inside a SysEx
+            emit(m, size, lane, now, send);
+        else if (size > 0 && (m[0] < 0x80 || m[0] == 0xF7))
+        {
+            emit(m, size, LANE_SYSEX, now, send);
+            STREAMED++;
+            streamUs = now;
+            if (m[size - 1] == 0xF7)
+                endStream(now, send, false);
+        }
+        else
+            hold(m, size);
+        return;
+    }
+    if (size > 0 && m[0] < 0x80)
+        return; // the rest of a SysEx whose start never made it here
+    if (lane == LANE_SYSEX && m[size - 1] != 0xF7)
+    {
+        if (ccTail != ccHead || !PARAMS.empty())
+            BARRIERS++;
+        drain(now, send);
+        emit(m, size, lane, now, send);
+        STREAMED++;
+        streaming = true;
+        streamUs = now;
+        return;
+    }
+    if (lane == LANE_SYSEX && PARAMS.submit(m, size, now))
+    {
+        service(now, send);
+        return;
+    }
+    if (lane == LANE_CC && size >= 3 && !program)
+    {
+        unsigned int &at = CC_AT[m[0] & 0x0F][m[1] & 0x7F];
+        if (at != NO_CC)
+            CCQ[at & (CC_RING - 1)].M[2] = m[2]; // newest value, same place in the queue
+        else
+        {
+            if (ccTail - ccHead == CC_RING)
+                emitCC(now, send); // full: the oldest goes first, never the new one past it
+            at = ccTail;
+            CC_RECORD &r = CCQ[ccTail++ & (CC_RING - 1)];
+            r.SIZE = 3;
+            memcpy(r.M, m, r.SIZE);
+        }
+        service(now, send);
+        return;
+    }
+    if (noteOn || noteOff || program || lane == LANE_SYSEX)
+    {
+        if (ccTail != ccHead || !PARAMS.empty())
+            BARRIERS++;
+        drain(now, send);
+    }
+    emit(m, size, lane, now, send);
+}
+
+// Sends the next queued parameter change, or the bulk dump of its voice
+// when that is cheaper.
+void OUT_SCHEDULER::emitParam(long long now, bool force, SEND_FN send)
+{
+    int key = PARAMS.peek(now, force);
+    if (emitBulk(key, now, send))
+        return;
+    unsigned char m[7];
+    PARAMS.pop(now, m, force);
+    emit(m, sizeof(m), LANE_SYSEX, now, send);
+}
+
+bool OUT_SCHEDULER::emitBulk(int key, long long now, SEND_FN send)
+{
+    static const BULK_FORMAT *const VOICE_4OP[2] = {&ACED_BULK, &VCED_BULK};
+    static const BULK_FORMAT *const VOICE_DX7[1] = {&DX7_BULK};
+    int group = keyGroup(key);
+    int channel = keyChannel(key);
+    // The cache only holds values sent or learned since the channel's last
+    // program change (TX_SHADOW::apply forgets the voice on one); a program
+    // change is never queued, so none can go out between here and the dump.
+    if (!CACHE || group == PCED)
+        return false;
+    bool dx7 = group == DX7_VOICE || group == DX7_VOICE_HI;
+    const BULK_FORMAT *const *voice = dx7 ? VOICE_DX7 : VOICE_4OP;
+    int dumps = dx7 ? 1 : 2;
+
+    int changed = 0;
+    int bytes = 0;
+    for (int d = 0; d < dumps; d++)
+    {
+        bytes += bulkSize(*voice[d]);
+        for (int i = 0; i < voice[d]->COUNT; i++)
+        {
+            int k = bulkKey(*voice[d], channel, i);
+            int queued = PARAMS.pending(k);
+            int known = CACHE->value(DEVICE, k);
+            if (queued < 0 && known < 0)
+                return false;
+            if (queued >= 0 && queued != known)
+                changed++;
+        }
+    }
+    if (changed * 7 <= bytes)
+        return false;
+
+    for (int d = 0; d < dumps; d++)
+    {
+        const BULK_FORMAT &f = *voice[d];
+        int count = f.PREFIX_SIZE + f.COUNT;
+        unsigned char *m = bulk;
+        *m++ = 0xF0;
+        *m++ = 0x43;
+        *m++ = channel;
+        *m++ = f.FORMAT;
+        *m++ = count >> 7;
+        *m++ = count & 0x7F;
+        memcpy(m, f.PREFIX, f.PREFIX_SIZE);
+        m += f.PREFIX_SIZE;
+        for (int i = 0; i < f.COUNT; i++)
+        {
+            int k = bulkKey(f, channel, i);
+            int queued = PARAMS.pending(k);
+            *m++ = queued >= 0 ? queued : CACHE->value(DEVICE, k);
+            PARAMS.take(k, now);
+        }
+        int sum = 0;
+        for (int i = 0; i < count; i++)
+            sum += bulk[6 + i];
+        *m++ = -sum & 0x7F;
+        *m++ = 0xF7;
+        emit(bulk, m - bulk, LANE_SYSEX, now, send);
+    }
+    BULKS++;
+    BULK_PARAMS += changed;
+    return true;
+}
+
+void OUT_SCHEDULER::service(long long now, SEND_FN send)
+{
+    if (streaming && now - streamUs >= STREAM_TIMEOUT_US)
+        endStream(now, send, true); // the sender went away in the middle of it
+    if (streaming)
+        return;
+    while (wireFree - now < BACKLOG_US)
+    {
+        if (ccTail != ccHead)
+            emitCC(now, send);
+        else if (PARAMS.peek(now) >= 0)
+            emitParam(now, false, send);
+        else
+            break;
+    }
+}
+
+void OUT_SCHEDULER::drain(long long now, SEND_FN send)
+{
+    while (streaming) // a held SysEx may start another one
+        endStream(now, send, true);
+    while (ccTail != ccHead)
+        emitCC(now, send);
+    while (!PARAMS.empty())
+        emitParam(now, true, send);
+}
+
+int OUT_SCHEDULER::replay(const TX_SHADOW &target, const TX_SHADOW &synth, long long now)
+{
+    int queued = 0;
+    unsigned char m[7];
+    for (int key = target.nextDiff(synth, 0); key >= 0; key = target.nextDiff(synth, key + 1))
+    {
+        paramFrame(key, target.value(key), m);
+        PARAMS.submit(m, sizeof(m), now);
+        queued++;
+    }
+    return queued;
+}
+
+long long OUT_SCHEDULER::nextWake(long long now) const
+{
+    if (streaming)
+        return streamUs + STREAM_TIMEOUT_US;
+    long long due = ccTail != ccHead ? now : PARAMS.nextDue();
+    if (due < 0)
+        return -1;
+    return std::max(due, wireFree - BACKLOG_US);
+}
+
+OUT_PIPE::OUT_PIPE() : DROP_POLICY(DROP_OLDEST), STALLS(0), TOO_LONG(0), nextSeq(0), havePr(false), sleeping(false)
+{
+}
+
+void OUT_PIPE::put(const unsigned char *m, size_t size, bool more)
+{
+    OUT_RECORD r;
+    r.SEQ = nextSeq++;
+    r.SIZE = (unsigned char)size;
+    r.MORE = more;
+    memcpy(r.M, m, size);
+    if (MAIN.push(r))
+        return;
+    STALLS++;
+    do
+    {
+        wake();
+        std::this_thread::yield();
+    } while (!MAIN.push(r));
+}
+
+void OUT_PIPE::push(const unsigned char *m, size_t size, bool notify)
+{
+    if (isParamChange(m, size) && paramKey(m) >= 0)
+    {
+        OUT_RECORD r;
+        r.SEQ = nextSeq++;
+        r.SIZE = (unsigned char)size;
+        r.MORE = 0;
+        memcpy(r.M, m, size);
+        PARAM.push(r, DROP_POLICY == DROP_NEWEST);
+    }
+    else if (size > SYSEX_MAX)
+    {
+        TOO_LONG++;
+        return;
+    }
+    else
+    {
+        size_t off = 0;
+        do
+        {
+            size_t n = std::min(size - off, sizeof(OUT_RECORD::M));
+            put(m + off, n, off + n < size);
+            off += n;
+        } while (off < size);
+    }
+    if (notify)
+        wake();
+}
+
+bool OUT_PIPE::pop(const unsigned char *&m, size_t &size)
+{
+    // PARAM is looked at before MAIN: the producer writes both in SEQ order,
+    // so every MAIN record older than pr is visible by now.
+    if (!havePr && PARAM.front(pr))
+    {
+        PARAM.pop();
+        havePr = true;
+    }
+    const OUT_RECORD *r = MAIN.front();
+    if (r && (!havePr || (int)(r->SEQ - pr.SEQ) < 0))
+    {
+        size = 0;
+        for (;;)
+        {
+            memcpy(MSG + size, r->M, r->SIZE);
+            size += r->SIZE;
+            bool more = r->MORE;
+            MAIN.pop();
+            if (!more)
+                break;
+            while (!(r = MAIN.front())) // rest of a long SysEx is still being written
+                std::this_thread::yield();
+        }
+        m = MSG;
+        return true;
+    }
+    if (!havePr)
+        return false;
+    memcpy(MSG, pr.M, pr.SIZE);
+    size = pr.SIZE;
+    havePr = false;
+    m = MSG;
+    return true;
+}
+
+void OUT_PIPE::wait(long long timeoutUs)
+{
+    std::unique_lock<std::mutex> lock(wakeLock);
+    sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!havePr && empty() && timeoutUs > 0)
+        wakeUp.wait_for(lock, std::chrono::microseconds(timeoutUs));
+    sleeping = false;
+}
+
+void OUT_PIPE::wake()
+{
+    // Only touches the lock while the output thread sleeps in wait().
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!sleeping)
+        return;
+    std::lock_guard<std::mutex> lock(wakeLock);
+    wakeUp.notify_one();
+}
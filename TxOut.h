@@ -0,0 +1,338 @@
+/*******************************************************************
+Output stages that sit between the translator in onMIDI and the
+RtMidiOut ports.
+*******************************************************************/
+#ifndef TXOUT_H
+#define TXOUT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include "TxRing.h"
+#include "TxShadow.h"
+
+// Wire time of one byte on a 31250 baud DIN link (start + 8 data + stop bits).
+const long DIN_BYTE_US = 320;
+
+// Output targets the caches and counters are kept for.
+enum OUT_DEVICES
+{
+    DEV_VIRTUAL = 0, // DX4OPSYX virtual port
+    DEV_HW = 1,      // hardware port given with -p
+    DEVICES = 2
+};
+
+inline long long nowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// What each device holds, as far as we sent it. Parameter changes that
+// would not change anything on the synth are dropped.
+class SYX_CACHE
+{
+public:
+    SYX_CACHE();
+
+    // False if the synth already holds this value, true otherwise.
+    // Anything that is not a cacheable parameter change is always admitted,
+    // voice bulk dumps update the values they carry.
+    bool admit(int device, const unsigned char *m, size_t size);
+
+    // Marks all values for the device unknown, e.g. after a failed send.
+    void forget(int device);
+
+    // Undoes admit() for a message that did not make it out.
+    void forget(int device, const unsigned char *m, size_t size);
+
+    // Values admitted since the last commit() may still sit in the driver's
+    // buffer. commit() after a successful flush, rollback() when the port
+    // is lost forgets only those (everything if there were too many).
+    void commit(int device) { nUnflushed[device] = 0; }
+    void rollback(int device);
+
+    // Value the synth holds for key, -1 if unknown.
+    int value(int device, int key) const { return SYNTH[device].value(key); }
+
+    const TX_SHADOW &synth(int device) const { return SYNTH[device]; }
+
+    std::atomic<unsigned long> SENT;
+    std::atomic<unsigned long> DROPPED;
+
+private:
+    void unflushed(int device, int key);
+
+    enum
+    {
+        UNFLUSHED_MAX = 1024
+    };
+    TX_SHADOW SYNTH[DEVICES];
+    int UNFLUSHED[DEVICES][UNFLUSHED_MAX]; // keys admitted since the last commit()
+    unsigned int nUnflushed[DEVICES];      // may exceed UNFLUSHED_MAX, then rollback() forgets all
+};
+
+// Hands a message to the port, false if it was not sent (e.g. dropped as a duplicate).
+typedef bool (*SEND_FN)(const unsigned char *m, size_t size);
+
+// Pending parameter changes, one slot per target. A parameter that has
+// not been sent for BOUND_US is due straight away, inside that window
+// only the newest value is kept and it becomes due once the window closes.
+class PARAM_COALESCER
+{
+public:
+    PARAM_COALESCER();
+
+    // Queues a parameter change, false if the frame is not one that can be merged.
+    bool submit(const unsigned char *m, size_t size, long long now);
+
+    // Takes the oldest due change into m (any held change if force is set).
+    bool pop(long long now, unsigned char *m, bool force = false);
+
+    // Key pop() would take next, -1 if none.
+    int peek(long long now, bool force = false) const;
+
+    // Queued value for key, -1 if none.
+    int pending(int key) const { return PENDING[key] == NONE ? -1 : PENDING[key]; }
+
+    // Removes key from the queue as if it had been sent at now.
+    void take(int key, long long now);
+
+    // Time the next held value is due, -1 if nothing is held.
+    long long nextDue() const;
+
+    bool empty() const { return nHeld == 0; }
+
+    long long BOUND_US; // 0 disables merging, changes are due at once
+    std::atomic<unsigned long> MERGED;
+
+private:
+    enum
+    {
+        NONE = 0xFF
+    };
+    long long LAST_US[PARAM_KEYS];
+    long long DUE_US[PARAM_KEYS];
+    unsigned char PENDING[PARAM_KEYS];
+    int HELD[PARAM_KEYS];
+    int nHeld;
+};
+
+enum OUT_LANES
+{
+    LANE_REALTIME, // clock, start/stop, active sensing
+    LANE_NOTE,     // notes, pitch bend, aftertouch, system common
+    LANE_CC,       // control and program changes (the latter never queued)
+    LANE_SYSEX,    // parameter changes and other SysEx
+    LANES
+};
+
+int laneOf(const unsigned char *m, size_t size);
+
+// Splits the output into priority lanes and paces the lower ones against
+// a model of the 31250 baud wire, so notes and clock never queue behind a
+// backlog of parameter edits. Realtime and note messages go out at once,
+// CCs and parameter changes only while the modelled backlog is below
+// BACKLOG_US. A queued CC is replaced by a newer value of the same
+// controller. A Note On or Off, a program change, or SysEx that is not a
+// parameter change, first releases everything
+// queued below it, so it always acts on the controllers and parameters
+// that were sent before it.
+// With CACHE set, a voice whose queued changes cost more wire time than
+// a bulk dump of the whole voice is sent as a bulk dump instead, as long
+// as every value of the voice is known (queued or held by the synth).
+// A SysEx pushed in pieces (the first starts with F0 and has no F7) is
+// sent piece by piece as it comes in. Until its F7 only realtime
+// messages may go between the pieces, everything else is held back in
+// arrival order and pushed again once the SysEx is complete.
+class OUT_SCHEDULER
+{
+public:
+    OUT_SCHEDULER();
+
+    void push(const unsigned char *m, size_t size, long long now, SEND_FN send);
+
+    // Releases queued CCs and parameter changes the wire has room for.
+    void service(long long now, SEND_FN send);
+
+    // Releases everything regardless of the wire model, ends an
+    // unfinished streamed SysEx with an F7 first.
+    void drain(long long now, SEND_FN send);
+
+    // When service() has work to do next, -1 if nothing is queued.
+    long long nextWake(long long now) const;
+
+    // Queues every value known in target that synth does not hold, as
+    // parameter changes paced like any other (a bulk dump where cheaper).
+    // Returns the number of values queued.
+    int replay(const TX_SHADOW &target, const TX_SHADOW &synth, long long now);
+
+    PARAM_COALESCER PARAMS;
+    long long BACKLOG_US; // default 3 ms, about one parameter change plus a note
+    std::atomic<unsigned long> SENT[LANES];
+    std::atomic<unsigned long> BARRIERS;
+
+    const SYX_CACHE *CACHE; // values the synth holds, 0 disables bulk dumps
+    int DEVICE;             // device CACHE is looked up for
+    std::atomic<unsigned long> BULKS;
+    std::atomic<unsigned long> BULK_PARAMS; // parameter changes replaced by bulk dumps
+
+    long long STREAM_TIMEOUT_US;              // a streamed SysEx with no piece for this long is ended with an F7
+    std::atomic<unsigned long> STREAMED;      // SysEx pieces sent as they came in
+    std::atomic<unsigned long> STREAM_ABORTS; // streamed SysEx we had to end ourselves
+    std::atomic<unsigned long> HOLD_DROPPED;  // messages that did not fit behind a streamed SysEx
+
+private:
+    void emit(const unsigned char *m, size_t size, int lane, long long now, SEND_FN send);
+    void emitParam(long long now, bool force, SEND_FN send);
+    bool emitBulk(int key, long long now, SEND_FN send);
+    void hold(const unsigned char *m, size_t size);
+    void endStream(long long now, SEND_FN send, bool abort);
+
+    void emitCC(long long now, SEND_FN send);
+
+    struct CC_RECORD
+    {
+        unsigned char M[3];
+        unsigned char SIZE;
+    };
+    enum
+    {
+        CC_RING = 256 // power of two
+    };
+    static const unsigned int NO_CC = ~0u;
+    CC_RECORD CCQ[CC_RING];
+    unsigned int ccHead;
+    unsigned int ccTail;
+    unsigned int CC_AT[16][128]; // ring position of the queued value a new one may replace, NO_CC if none
+    long long wireFree; // modelled time the wire is idle again
+    unsigned char bulk[8 + 155];
+
+    enum
+    {
+        HOLD_BYTES = 16384 // messages held behind a streamed SysEx, 2 byte length + bytes each
+    };
+    bool streaming;     // a SysEx piece without F7 went out, its end has not
+    long long streamUs; // when the last piece went out
+    unsigned char HOLD[HOLD_BYTES];
+    size_t holdUsed;
+};
+
+// One message, or a 10 byte piece of a longer one, on its way from the
+// input thread to the output thread. SEQ orders records across rings.
+struct OUT_RECORD
+{
+    unsigned int SEQ;
+    unsigned char SIZE; // bytes used in M
+    unsigned char MORE; // 1 if the message continues in the next record
+    unsigned char M[10];
+};
+
+enum DROP_POLICIES
+{
+    DROP_OLDEST, // a full parameter ring overwrites its oldest change
+    DROP_NEWEST  // a full parameter ring refuses the incoming change
+};
+
+// Hand-off from the input thread (push) to the output thread (pop/wait).
+// Parameter changes ride a ring that drops under overload, everything
+// else rides a lossless ring; when that one is full the input thread
+// yields until the output thread catches up, notes are never dropped.
+// pop() merges both rings back into arrival order.
+class OUT_PIPE
+{
+public:
+    OUT_PIPE();
+
+    // Producer side, never allocates. Without notify the consumer is only
+    // woken by a later push() or wake(), for handing over a burst at once.
+    void push(const unsigned char *m, size_t size, bool notify = true);
+
+    // Consumer side. m points into the pipe and stays valid until the next pop.
+    bool pop(const unsigned char *&m, size_t &size);
+
+    // Sleeps until push() or for at most timeoutUs.
+    void wait(long long timeoutUs);
+    void wake();
+
+    bool empty() const { return MAIN.empty() && PARAM.empty(); }
+
+    int DROP_POLICY;
+    std::atomic<unsigned long> STALLS;   // messages the input thread had to wait for room for
+    std::atomic<unsigned long> TOO_LONG; // SysEx dropped for not fitting SYSEX_MAX
+    unsigned long paramDropped() const { return PARAM.DROPPED; }
+
+private:
+    enum
+    {
+        MAIN_RING = 1024, // records, a 10 KB dump fits without stalling
+        PARAM_RING = 256,
+        SYSEX_MAX = 65536
+    };
+    void put(const unsigned char *m, size_t size, bool more);
+
+    SPSC_RING<OUT_RECORD, MAIN_RING> MAIN;
+    OVERWRITE_RING<OUT_RECORD, PARAM_RING> PARAM;
+    unsigned int nextSeq;
+    unsigned char MSG[SYSEX_MAX]; // message handed out by pop()
+    OUT_RECORD pr;
+    bool havePr;
+    std::atomic<bool> sleeping;
+    std::mutex wakeLock;
+    std::condition_variable wakeUp;
+};
+
+enum PORT_STATES
+{
+    PORT_CLOSED, // not opened yet
+    PORT_UP,
+    PORT_DOWN // failed or gone, waiting to be reopened
+};
+
+// Health of an output port. The first failure takes it down, from then on
+// sends are dropped after a single load until the port is reopened, so a
+// dead port costs nothing and only the transitions get logged.
+class PORT_HEALTH
+{
+public:
+    PORT_HEALTH() : STATE(PORT_CLOSED), FAILURES(0), DROPPED(0) {}
+
+    bool up() const { return STATE == PORT_UP; }
+
+    // True if this took the port down.
+    bool fail()
+    {
+        FAILURES++;
+        int was = PORT_UP;
+        return STATE.compare_exchange_strong(was, PORT_DOWN);
+    }
+
+    // True if the port had been up before, i.e. it came back.
+    bool open() { return STATE.exchange(PORT_UP) == PORT_DOWN; }
+
+    std::atomic<int> STATE;
+    std::atomic<unsigned long> FAILURES;
+    std::atomic<unsigned long> DROPPED; // sends skipped while not up
+};
+
+// Direction aware hysteresis for jittery CC sources. A value moving on
+// in the same direction as the last accepted one always passes, turning
+// around needs a step of more than WIDTH. The knob ends always pass.
+class CC_HYSTERESIS
+{
+public:
+    CC_HYSTERESIS();
+
+    bool admit(int channel, int cc, int value);
+
+    int WIDTH; // 0 disables
+    std::atomic<unsigned long> DROPPED;
+
+private:
+    signed char LAST[16][128];
+    signed char DIR[16][128];
+};
+
+#endif
@@ -0,0 +1,146 @@
+/*******************************************************************
+Single producer / single consumer rings used to hand messages from
+the ALSA input thread to the output thread without locks.
+
+SPSC_RING never loses an element, push() fails when it is full.
+OVERWRITE_RING never makes the producer wait: when it is full the
+oldest element is overwritten and the consumer skips ahead.
+N must be a power of two for both.
+*******************************************************************/
+#ifndef TXRING_H
+#define TXRING_H
+
+#include <atomic>
+#include <cstring>
+
+template <typename T, unsigned int N>
+class SPSC_RING
+{
+public:
+    SPSC_RING() : head(0), tail(0) {}
+
+    bool push(const T &v)
+    {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= N)
+            return false;
+        slots[h & (N - 1)] = v;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Looks at the oldest element without taking it.
+    const T *front()
+    {
+        unsigned int t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t)
+            return 0;
+        return &slots[t & (N - 1)];
+    }
+
+    void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+private:
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+    std::atomic<unsigned int> head;
+    std::atomic<unsigned int> tail;
+    T slots[N];
+};
+
+// Every slot carries a sequence number (odd while it is being written),
+// the consumer copies a slot and re-checks the number to detect that the
+// producer lapped it in the meantime. T is copied as 32 bit words so the
+// racing reads stay well defined.
+template <typename T, unsigned int N>
+class OVERWRITE_RING
+{
+public:
+    OVERWRITE_RING() : DROPPED(0), head(0), tail(0)
+    {
+        for (unsigned int i = 0; i < N; i++)
+            slots[i].SEQ.store(0, std::memory_order_relaxed);
+    }
+
+    // With dropNewest set a full ring drops v instead of the oldest element.
+    void push(const T &v, bool dropNewest = false)
+    {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        if (dropNewest && h - tail.load(std::memory_order_acquire) >= N)
+        {
+            DROPPED.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        SLOT &s = slots[h & (N - 1)];
+        unsigned int w[WORDS];
+        memcpy(w, &v, sizeof(T));
+        s.SEQ.store(2 * h + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (unsigned int i = 0; i < WORDS; i++)
+            s.W[i].store(w[i], std::memory_order_relaxed);
+        s.SEQ.store(2 * h + 2, std::memory_order_release);
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    // Copies the oldest element still in the ring into v without taking it.
+    bool front(T &v)
+    {
+        for (;;)
+        {
+            unsigned int t = tail.load(std::memory_order_relaxed);
+            unsigned int h = head.load(std::memory_order_acquire);
+            if (h == t)
+                return false;
+            if (h - t > N)
+            {
+                skip(t, h - N);
+                continue;
+            }
+            SLOT &s = slots[t & (N - 1)];
+            unsigned int seq = s.SEQ.load(std::memory_order_acquire);
+            unsigned int w[WORDS];
+            for (unsigned int i = 0; i < WORDS; i++)
+                w[i] = s.W[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq != 2 * t + 2 || s.SEQ.load(std::memory_order_relaxed) != seq)
+            {
+                skip(t, t + 1); // overwritten while we looked, the producer is a lap ahead
+                continue;
+            }
+            memcpy(&v, w, sizeof(T));
+            return true;
+        }
+    }
+
+    void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+    std::atomic<unsigned long> DROPPED;
+
+private:
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+    static_assert(sizeof(T) % 4 == 0, "element size must be a multiple of 4");
+    enum
+    {
+        WORDS = sizeof(T) / 4
+    };
+    struct SLOT
+    {
+        std::atomic<unsigned int> SEQ;
+        std::atomic<unsigned int> W[WORDS];
+    };
+
+    void skip(unsigned int from, unsigned int to)
+    {
+        DROPPED.fetch_add(to - from, std::memory_order_relaxed);
+        tail.store(to, std::memory_order_release);
+    }
+
+    std::atomic<unsigned int> head;
+    std::atomic<unsigned int> tail;
+    SLOT slots[N];
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include <cstring>
+#include "TxShadow.h"
+#include "TxDevice.h"
+
+static const unsigned char SLOT_GROUPS[PARAM_GROUP_SLOTS] = {DX7_VOICE, DX7_VOICE_HI, VCED, ACED, PCED};
+
+int paramKey(const unsigned char *m)
+{
+    int slot;
+    switch (m[3])
+    {
+    case DX7_VOICE: slot = 0; break;
+    case DX7_VOICE_HI: slot = 1; break;
+    case VCED: slot = 2; break;
+    case ACED:
+        if (m[4] >= 64) // remote switches are key presses, never cache or merge them
+            return -1;
+        slot = 3;
+        break;
+    case PCED: slot = 4; break;
+    default: return -1;
+    }
+    return ((m[2] & 0x0F) * PARAM_GROUP_SLOTS + slot) * 128 + (m[4] & 0x7F);
+}
+
+void paramFrame(int key, unsigned char value, unsigned char *m)
+{
+    m[0] = 0xF0;
+    m[1] = 0x43;
+    m[2] = 0x10 | keyChannel(key);
+    m[3] = SLOT_GROUPS[key / 128 % PARAM_GROUP_SLOTS];
+    m[4] = key % 128;
+    m[5] = value;
+    m[6] = 0xF7;
+}
+
+int keyGroup(int key)
+{
+    return SLOT_GROUPS[key / 128 % PARAM_GROUP_SLOTS];
+}
+
+int bulkKey(const BULK_FORMAT &f, int channel, int i)
+{
+    unsigned char m[5] = {0xF0, 0x43, (unsigned char)(0x10 | channel), (unsigned char)f.GROUP, (unsigned char)i};
+    if (f.GROUP == DX7_VOICE && i >= 128)
+    {
+        m[3] = DX7_VOICE_HI;
+        m[4] = i - 128;
+    }
+    return paramKey(m);
+}
+
+const BULK_FORMAT *bulkFormat(const unsigned char *m, size_t size)
+{
+    static const BULK_FORMAT *const FORMATS[3] = {&VCED_BULK, &ACED_BULK, &DX7_BULK};
+    if (size < 8 || m[0] != 0xF0 || m[1] != 0x43 || (m[2] & 0xF0) != 0x00)
+        return 0;
+    for (const BULK_FORMAT *f : FORMATS)
+    {
+        int count = f->PREFIX_SIZE + f->COUNT;
+        if (m[3] != f->FORMAT || size != (size_t)bulkSize(*f) || (m[4] << 7 | m[5]) != count)
+            continue;
+        if (memcmp(m + 6, f->PREFIX, f->PREFIX_SIZE) != 0)
+            return 0;
+        int sum = 0;
+        for (int i = 0; i <= count; i++)
+            sum += m[6 + i];
+        return (sum & 0x7F) == 0 ? f : 0;
+    }
+    return 0;
+}
+
+TX_SHADOW::TX_SHADOW()
+{
+    forget();
+}
+
+unsigned char *TX_SHADOW::at(int key)
+{
+    return const_cast<unsigned char *>(static_cast<const TX_SHADOW *>(this)->at(key));
+}
+
+const unsigned char *TX_SHADOW::at(int key) const
+{
+    if (key < 0 || key >= PARAM_KEYS)
+        return 0;
+    const TX_VOICE &v = CH[keyChannel(key)];
+    int p = key % 128;
+    switch (keyGroup(key))
+    {
+    case DX7_VOICE: return &v.DX7[p];
+    case DX7_VOICE_HI: return 128 + p < TX_VOICE::DX7_PARAMS ? &v.DX7[128 + p] : 0;
+    case VCED: return p < TX_VOICE::VCED_PARAMS ? &v.VCED[p] : 0;
+    case ACED: return p < TX_VOICE::ACED_PARAMS ? &v.ACED[p] : 0;
+    default: return p < TX_VOICE::PCED_PARAMS ? &v.PCED[p] : 0;
+    }
+}
+
+int TX_SHADOW::value(int key) const
+{
+    const unsigned char *v = at(key);
+    return !v || *v == UNKNOWN ? -1 : *v;
+}
+
+void TX_SHADOW::learn(const BULK_FORMAT &f, const unsigned char *m)
+{
+    int channel = m[2] & 0x0F;
+    const unsigned char *data = m + 6 + f.PREFIX_SIZE;
+    for (int i = 0; i < f.COUNT; i++)
+        *at(bulkKey(f, channel, i)) = data[i];
+    if (f.GROUP == VCED && acedChannel != channel) // a lone VCED dump resets ACED to values we do not know
+        memset(CH[channel].ACED, UNKNOWN, sizeof(CH[channel].ACED));
+    acedChannel = f.GROUP == ACED ? channel : -1;
+}
+
+bool TX_SHADOW::apply(const unsigned char *m, size_t size)
+{
+    if (isParamChange(m, size))
+    {
+        acedChannel = -1;
+        unsigned char *v = at(paramKey(m));
+        if (v)
+            *v = m[5];
+        return true;
+    }
+    const BULK_FORMAT *f = bulkFormat(m, size);
+    if (f)
+    {
+        learn(*f, m);
+        return true;
+    }
+    if (size > 0 && m[0] < 0xF8)
+        acedChannel = -1;
+    if (size >= 2 && (m[0] & 0xF0) == 0xC0) // the synth loads another voice
+        forgetVoice(m[0] & 0x0F);
+    else if (size >= 4 && m[0] == 0xF0 && m[1] == 0x43 && (m[2] & 0xF0) == 0x00)
+        forgetVoice(m[2] & 0x0F); // a dump we cannot read (bank, performance, bad checksum) may have changed it
+    return false;
+}
+
+void TX_SHADOW::forgetVoice(int channel)
+{
+    TX_VOICE &v = CH[channel & 0x0F];
+    memset(v.VCED, UNKNOWN, sizeof(v.VCED));
+    memset(v.ACED, UNKNOWN, sizeof(v.ACED));
+    memset(v.DX7, UNKNOWN, sizeof(v.DX7));
+}
+
+void TX_SHADOW::forget()
+{
+    memset(CH, UNKNOWN, sizeof(CH));
+    acedChannel = -1;
+}
+
+int TX_SHADOW::nextDiff(const TX_SHADOW &other, int key) const
+{
+    for (; key < PARAM_KEYS; key++)
+    {
+        const unsigned char *v = at(key);
+        if (v && *v != UNKNOWN && *v != *other.at(key))
+            return key;
+    }
+    return -1;
+}
@@ -0,0 +1,93 @@
+/*******************************************************************
+Shadow of what a synth holds: the VCED/ACED/PCED blocks of the 4-op
+TX81Z and the DX7 voice, for all 16 channels, kept as the byte arrays
+the parameter tables in main.cpp number them. The output stages diff,
+dedup and bulk encode against it.
+*******************************************************************/
+#ifndef TXSHADOW_H
+#define TXSHADOW_H
+
+#include <cstddef>
+
+struct BULK_FORMAT;
+
+// True for a 7 byte F0 43 1n gg pp dd F7 parameter change.
+inline bool isParamChange(const unsigned char *m, size_t size)
+{
+    return size == 7 && m[0] == 0xF0 && m[1] == 0x43 && (m[2] & 0xF0) == 0x10 && m[6] == 0xF7;
+}
+
+// Parameter changes are tracked per (channel, group, parameter). paramKey()
+// flattens that into 0..PARAM_KEYS-1, or -1 for frames that must not be
+// cached or merged (remote switches, unknown groups).
+const int PARAM_GROUP_SLOTS = 5;
+const int PARAM_KEYS = 16 * PARAM_GROUP_SLOTS * 128;
+int paramKey(const unsigned char *m);
+void paramFrame(int key, unsigned char value, unsigned char *m);
+
+// Group byte (SYX_GROUPS) and channel of a key.
+int keyGroup(int key);
+inline int keyChannel(int key) { return key / (PARAM_GROUP_SLOTS * 128); }
+
+// Key of data byte i in a bulk dump for channel.
+int bulkKey(const BULK_FORMAT &f, int channel, int i);
+
+// Format of a complete, correctly checksummed bulk dump, 0 for anything else.
+const BULK_FORMAT *bulkFormat(const unsigned char *m, size_t size);
+
+// One channel, 383 bytes.
+struct TX_VOICE
+{
+    enum
+    {
+        VCED_PARAMS = 94,
+        ACED_PARAMS = 23,
+        PCED_PARAMS = 110,
+        DX7_PARAMS = 156
+    };
+    unsigned char VCED[VCED_PARAMS];
+    unsigned char ACED[ACED_PARAMS];
+    unsigned char PCED[PCED_PARAMS];
+    unsigned char DX7[DX7_PARAMS];
+};
+
+class TX_SHADOW
+{
+public:
+    enum
+    {
+        UNKNOWN = 0xFF
+    };
+
+    TX_SHADOW();
+
+    // Byte holding key, 0 for keys outside the parameter tables.
+    unsigned char *at(int key);
+    const unsigned char *at(int key) const;
+
+    // Value for key, -1 if unknown or outside the tables.
+    int value(int key) const;
+
+    // Records a parameter change or voice bulk dump, false if m is neither.
+    // A program change, or a Yamaha dump that is not a voice dump we can
+    // read, makes the voice of its channel unknown.
+    bool apply(const unsigned char *m, size_t size);
+
+    // Marks everything unknown.
+    void forget();
+
+    // Marks the VCED, ACED and DX7 voice of channel unknown, PCED is kept.
+    void forgetVoice(int channel);
+
+    // First key from key on that is known here and differs in other, -1 if none.
+    int nextDiff(const TX_SHADOW &other, int key) const;
+
+    TX_VOICE CH[16];
+
+private:
+    void learn(const BULK_FORMAT &f, const unsigned char *m);
+
+    int acedChannel; // channel of an ACED dump applied last, -1 if none
+};
+
+#endif
@@ -33,7 +33,7 @@ F7h        End Of Exclusive
   See p.73 for parameter numbers and data.
 
 * PCED (Performance parameters)
-  ggggg = 00100 (4), hh = 11 (3)
+  ggggg = 00100 (4), hh = 00 (0)
   See p.74 for parameter numbers and data.
 
 * Remote Switch (The same effect as pressing a switch on the TX81Z front
@@ -208,8 +208,20 @@ Parameter number | Parameter
 #include <sys/time.h>
 #include <ctime>
 #include "RtMidi.h"
+#include "TxMap.h"
+#include "TxOut.h"
+#include "TxBench.h"
+#include "TxHotplug.h"
+#include "TxLoop.h"
+#include "TxEpoch.h"
 #include <chrono>
 #include <csignal>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
 const unsigned char nouts = 16;
 using namespace std;
 using std::chrono::duration_cast;
@@ -217,198 +229,103 @@ using std::chrono::seconds;
 using std::chrono::system_clock;
 
 const string PORT_PREFIX = "DX4OP";
-void onMIDI(double deltatime, std::vector<unsigned char> *message, void * /*userData*/);
-int limit(int val, int min, int max);
+void onMIDI(long long deltaUs, const unsigned char *bytes, size_t size, void * /*userData*/);
+void onBatch(const RtMidiIn::RtMidiInRecord *records, size_t count, void * /*userData*/);
+void translate(const unsigned char *bytes, size_t size);
+bool superseded(const RtMidiIn::RtMidiInRecord *records, size_t i, size_t count);
+void translateCC(unsigned char status, unsigned char cc, unsigned char value);
 unsigned char validCC[14] = {1, 2, 7, 10, 64, 66, 120, 121, 122, 123, 124, 125, 126, 127};
 void print();
 void cleanup();
 void listInports();
 void initHWPORT();
+void checkHWPORT(bool announced);
+bool resolveHWPORT();
 void signalHandler(int signum);
 string oPORTNAME = "";
-bool HW_EXISTS = false;
+PORT_HEALTH HW;   // state of the -p port
+PORT_WATCH WATCH; // ALSA announcements, reopens the -p port as soon as it shows up
+RtMidiPortInfo HW_ADDR;   // where oPORTNAME was found, client:port on ALSA
+bool HW_RESOLVED = false; // HW_ADDR is current, cleared by announcements only
+void onOutputError(RtMidiError::Type type, const std::string &errorText, void *userData);
 void listOutPorts();
 long long getSecs();
-int getOutPort(std::string str);
-int getInPort(std::string str);
+bool findPort(RtMidi *midi, unsigned int caps, const std::string &str, RtMidiPortInfo &found);
 long long nextCheck = 0;
-void sendMessage(vector<unsigned char> *message);
-vector<unsigned char> BASE_SYX{0xF0, 0x43, 0x10, 0, 0, 0, 0xF7};
-enum BPOS
-{
-    GROUP = 3,
-    PARAMETER = 4,
-    DATA = 5
-
-};
-enum CCTYPES
-{
-    SYSTEM,
-    SYSEX,
-    SKIP,
-    CC
-};
-
-struct CC_MAPPING
-{
-    //  int x = 0;
-    CC_MAPPING(CCTYPES TYPE, int CC, int MIN, int MAX, int GROUP, int PARAMETER) : TYPE(TYPE), CC(CC), MIN(MIN), MAX(MAX), GROUP(GROUP), PARAMETER(PARAMETER){};
-    CCTYPES TYPE = SKIP;
-    int CC = 0;
-    int MIN = 0;
-    int MAX = 99;
-    int GROUP = 0;
-    int PARAMETER = 0;
-};
-//note - 4 op synths need value of 12 or 13 for the groups 
-CC_MAPPING MAP[128] = {
-    {SYSEX, 0, 0, 1, 12, 63},    //0  Poly Mono mode 
-    {SYSEX, 1, 0, 48, 12, 62},   // 1 Transpose
-    {CC, 2, 0, 127, 0, 0},       // breath
-    {SYSEX, 3, 0, 99, 12, 54},   // 3 LFO SPEED
-    {CC, 4, 0, 127, 0, 0},       // Foot
-    {CC, 5, 0, 127, 0, 0},       // Portamento
-    {SYSEX, 6, 0, 99, 12, 55},   // LFO DELAY
-    {CC, 7, 0, 127, 0, 0},       // 7 Volume
-    {SYSEX, 8, 0, 99, 12, 56},   // 8 LFO PMD
-    {SYSEX, 9, 0, 99, 12, 57},   // 9 LFO AMD
-    {CC, 10, 0, 127, 0, 0},      // 10 PAN
-    {SYSEX, 11, 0, 12, 12, 64},   // 11  Pitch Bend Range
-    {SYSEX, 12, 0, 3, 12, 59},    // 12 LFO WAVE
-    {SYSEX, 13, 0, 1, 12, 58},   // 13 LFO Sync
-    {SYSEX, 14, 0, 7, 12, 60},   // 14 LFO PMS
-    {SYSEX, 15, 0, 3, 12, 61},    // 15 LFO AMS
-    {SYSEX, 16, 0, 1, 12, 65},    // 16 Portamento Mode
-    {SYSEX, 17, 0, 99, 12, 66},   // 17 Portamento Time
-    {SYSEX, 18, 0, 99, 12, 67},    // 18 FC Volume 
-    {SYSEX, 19, 0, 1, 12, 68},    // 19 Sustain
-    {SYSEX, 20, 0, 99, 12, 69},  // 20 Portamento
-    {SYSEX, 21, 0, 99, 0, 84},   // 21 Mod Wheel  Pitch
-    {SYSEX, 22, 0, 99, 0, 63},   // 22 Mod Wheel Amplitude
-    {SYSEX, 23, 0, 99, 0, 42},   // 23 a Rate op4
-    {SYSEX, 24, 0, 99, 0, 21},   // 24
-    {SYSEX, 25, 0, 99, 0, 0},    // 25 op6
-    {SYSEX, 26, 0, 99, 0, 106},  // 26 Decay op1
-    {SYSEX, 27, 0, 99, 0, 85},   // 27
-    {SYSEX, 28, 0, 99, 0, 64},   // 28
-    {SYSEX, 29, 0, 99, 0, 43},   // 29
-    {SYSEX, 30, 0, 99, 0, 22},   // 30
-    {SYSEX, 31, 0, 99, 0, 1},    // 1
-    {SYSEX, 32, 0, 99, 0, 107},  // Sus op1
-    {SYSEX, 33, 0, 99, 0, 86},   // 1
-    {SYSEX, 34, 0, 99, 0, 65},   // 1
-    {SYSEX, 35, 0, 99, 0, 44},   // 1
-    {SYSEX, 36, 0, 99, 0, 23},   // 1
-    {SYSEX, 37, 0, 99, 0, 2},    // 1
-    {SYSEX, 38, 0, 99, 0, 108},  // 1 REl op1
-    {SYSEX, 39, 0, 99, 0, 87},   // 1
-    {SYSEX, 40, 0, 99, 0, 66},   // 1
-    {SYSEX, 41, 0, 99, 0, 45},   // 1
-    {SYSEX, 42, 0, 99, 0, 24},   // 1
-    {SYSEX, 43, 0, 99, 0, 3},    //
-    {SYSEX, 44, 0, 31, 0, 123},  // 1 Coarse op1
-    {SYSEX, 45, 0, 31, 0, 102},  // 1
-    {SYSEX, 46, 0, 31, 0, 81},   // 1
-    {SYSEX, 47, 0, 31, 0, 60},   // 1
-    {SYSEX, 48, 0, 31, 0, 39},   // 1
-    {SYSEX, 49, 0, 31, 0, 18},   // 1
-    {SYSEX, 50, 0, 99, 0, 124},  // 1 Fine Op1
-    {SYSEX, 51, 0, 99, 0, 103},  // 1
-    {SYSEX, 52, 0, 99, 0, 82},   // 1
-    {SYSEX, 53, 0, 99, 0, 61},   // 1
-    {SYSEX, 54, 0, 99, 0, 40},   // 1
-    {SYSEX, 55, 0, 99, 0, 19},   // 1
-    {SKIP, 56, 0, 127, 0, 0},    // 1
-    {SKIP, 57, 0, 127, 0, 0},    // 1
-    {SKIP, 58, 0, 127, 0, 0},    // 1
-    {SKIP, 59, 0, 127, 0, 0},    // 1
-    {SKIP, 60, 0, 127, 0, 0},    // 1
-    {SKIP, 61, 0, 127, 0, 0},    // 1
-    {SKIP, 62, 0, 127, 0, 0},    // 1
-    {SKIP, 63, 0, 127, 0, 0},    // 1
-    {CC, 64, 0, 127, 0, 0},      // Sustain
-    {SKIP, 65, 0, 127, 0, 0},    // 1
-    {CC, 66, 0, 127, 0, 0},      // Sostenuto
-    {SKIP, 67, 0, 127, 0, 0},    // 1
-    {SKIP, 68, 0, 127, 0, 0},    // 1
-    {SKIP, 69, 0, 127, 0, 0},    // 1
-    {SKIP, 70, 0, 127, 0, 0},    // 1
-    {CC, 71, 0, 127, 0, 0},      // 1 Resonane For Dexed -
-    {SKIP, 72, 0, 127, 0, 0},    // 1
-    {SYSEX, 73, 0, 48, 1, 16},   // Transpose
-    {CC, 74, 0, 127, 0, 0},      // Curoff for Dexed Midi Learn - not required 
-    {SYSEX, 75, 0, 7, 1, 7},     // Feedback
-    {SYSEX, 76, 0, 31, 1, 6},    // Algorithm
-    {SKIP, 77, 0, 127, 0, 0},    // 1
-    {SYSEX, 78, 0, 99, 0, 109},  // Atk level 1
-    {SYSEX, 79, 0, 99, 0, 110},  //  dc 1 lvl 1
-    {SYSEX, 80, 0, 99, 0, 111},  // sus lvl 1
-    {SYSEX, 81, 0, 99, 0, 112},  // rel lvl 1
-    {SYSEX, 82, 0, 99, 0, 88},   // a lvl 2
-    {SYSEX, 83, 0, 99, 0, 89},   // 1
-    {SYSEX, 84, 0, 99, 0, 90},   // 1
-    {SYSEX, 85, 0, 99, 0, 91},   // 1
-    {SYSEX, 86, 0, 99, 0, 67},   // op3
-    {SYSEX, 87, 0, 99, 0, 68},   // 1
-    {SYSEX, 88, 0, 99, 0, 69},   // 1
-    {SYSEX, 89, 0, 99, 0, 70},   // 1
-    {SYSEX, 90, 0, 99, 0, 46},   // op 4
-    {SYSEX, 91, 0, 99, 0, 47},   // 1
-    {SYSEX, 92, 0, 99, 0, 48},   // 1
-    {SYSEX, 93, 0, 99, 0, 49},   // 1
-    {SYSEX, 94, 0, 99, 0, 25},   // op5
-    {SYSEX, 95, 0, 99, 0, 26},   // 1
-    {SYSEX, 96, 0, 99, 0, 27},   // 1
-    {SYSEX, 97, 0, 99, 0, 28},   // 1
-    {SYSEX, 98, 0, 99, 0, 4},    // op6
-    {SYSEX, 99, 0, 99, 0, 5},    // 1
-    {SYSEX, 100, 0, 99, 0, 6},   // 1
-    {SYSEX, 101, 0, 99, 0, 7},   // 1
-    {SYSEX, 102, 0, 99, 0, 121}, // op level 1
-    {SYSEX, 103, 0, 99, 0, 100}, // 1
-    {SYSEX, 104, 0, 99, 0, 79},  // 1
-    {SYSEX, 105, 0, 99, 0, 58},  // 1
-    {SYSEX, 106, 0, 99, 0, 37},  // 1
-    {SYSEX, 107, 0, 99, 0, 16},  // 1
-    {SKIP, 108, 0, 127, 0, 0},   // 1
-    {SKIP, 109, 0, 127, 0, 0},   // 1
-    {SKIP, 110, 0, 127, 0, 0},   // 1
-    {SKIP, 111, 0, 127, 0, 0},   // 1
-    {SKIP, 112, 0, 127, 0, 0},   // 1
-    {SKIP, 113, 0, 127, 0, 0},   // 1
-    {SKIP, 114, 0, 127, 0, 0},   // 1
-    {SKIP, 115, 0, 127, 0, 0},   // 1
-    {SKIP, 116, 0, 127, 0, 0},   // 1
-    {SKIP, 117, 0, 127, 0, 0},   // 1
-    {SKIP, 118, 0, 127, 0, 0},   // 1
-    {SKIP, 119, 0, 127, 0, 0},   // 1
-    {SYSTEM, 120, 0, 127, 0, 0}, // 1
-    {SYSTEM, 121, 0, 127, 0, 0}, // 1
-    {SYSTEM, 122, 0, 127, 0, 0}, // 1
-    {SYSTEM, 123, 0, 127, 0, 0}, // 1
-    {SYSTEM, 124, 0, 127, 0, 0}, // 1
-    {SYSTEM, 125, 0, 127, 0, 0}, // 1
-    {SYSTEM, 126, 0, 127, 0, 0}, // 1
-    {SYSTEM, 127, 0, 127, 0, 0}, // 1
-
-};
+void sendMessage(const unsigned char *message, size_t size);
+bool sendNow(const unsigned char *message, size_t size);
+void flushOutput();
+void hwFailed();
+void outputThread();
+void outputMessage(const unsigned char *message, size_t size);
+long long serviceOutput();
+void runLoop();
+void printStats();
+
+// Heap allocation counters, only counted when built with TXSEX_COUNT_ALLOCS.
+// Every operator new bumps the calling thread's counter, onMIDI and onBatch add
+// whatever its thread allocated while translating a message to HOT_ALLOCS.
+// It should stay at 0 once the first message went out.
+thread_local unsigned long THREAD_ALLOCS = 0;
+std::atomic<unsigned long> HOT_ALLOCS(0);
+std::atomic<unsigned long> HOT_MESSAGES(0);
+
+SYX_CACHE SENT_CACHE;     // what the synth holds, drops parameter changes it already has
+TX_SHADOW TARGET;         // what the knobs asked for, whether it reached the synth or not
+CC_HYSTERESIS HYSTERESIS; // -hyst N, for jittery knobs
+OUT_SCHEDULER SCHED;      // priority lanes, -coalesce MS merges knob sweeps
+
+// onMIDI and onBatch only queue into OUTQ. Scheduling, the duplicate cache and the
+// port writes all run on OUT_THREAD, so a slow port never holds up input.
+OUT_PIPE OUTQ;
+std::thread OUT_THREAD;
+std::atomic<bool> OUT_RUN(true);
+std::atomic<bool> RESYNC(false); // set when the hardware port is back, the output thread replays TARGET
+bool FULL_RESYNC = false;        // -resync full: assume the synth lost everything while it was away
+std::atomic<unsigned long> REPLAYED(0);
+
+// onBatch pushes a whole burst into OUTQ and wakes the output thread once.
+bool HOLD_WAKE = false;
+
+// -epoll: no threads at all. onBatch runs from LOOP on the main thread
+// and schedules directly, OUTQ and OUT_THREAD stay unused.
+bool SINGLE_THREAD = false;
+EVENT_LOOP LOOP;
+
+// Threaded mode: signalHandler only records Ctrl-C here and kicks WATCH,
+// main() sees it, leaves its loop and shuts down on the main thread. The
+// other threads are started with SIGINT blocked so it always lands on main.
+volatile sig_atomic_t STOP = 0;
+
+// -route: the sequencer connects every sender of the CC port to the -p
+// port directly, only CCs and program changes still come through onBatch.
+std::atomic<bool> KERNEL_ROUTE(false); // read by the input and output threads, cleared when routing fails
 
 RtMidiIn *midiIn = 0;
 RtMidiOut *SYX = 0;
-RtMidiOut *HWOUT = 0;
+
+// The -p port. initHWPORT opens a fresh RtMidiOut on the main thread and
+// publishes it, the output thread pins it per write, so a reconnect
+// never closes a port under a write and a write never waits for one.
+EPOCH_PTR<RtMidiOut> HWOUT;
+const unsigned int OUT_READER = 0; // HWOUT reader slot of the output thread (main with -epoll)
 
 
 int main(int argc, char *argv[])
 {
+    buildLuts();
     midiIn = new RtMidiIn();
-    midiIn->setCallback(&onMIDI);
+    midiIn->setSpanCallback(&onMIDI);       // CoreMIDI, JACK, WinMM
+    midiIn->setBatchCallback(&onBatch);     // ALSA: takes precedence, everything pending in one call
     midiIn->ignoreTypes(false, false, true); // dont ignore clock
     SYX = new RtMidiOut();
-    HWOUT = new RtMidiOut();
     signal(SIGINT, signalHandler);
+    SCHED.PARAMS.BOUND_US = 20000;
+    bool bulk = true;
 
-    if (argc > 1) {
-        string cmd(argv[1]);
+    for (int i = 1; i < argc; i++)
+    {
+        string cmd(argv[i]);
         cout << "Command: " << cmd << endl;
         if (cmd == "-ports")
         {
@@ -418,199 +335,547 @@ int main(int argc, char *argv[])
         }
         if (cmd == "-p")
         {
-            if (argc < 3)
+            if (i + 1 >= argc)
             {
                 cout << "Error ! Please Provide Midi Port Name to bind to!" << endl;
                 cleanup();
             }
-            oPORTNAME = string(argv[2]);
-            initHWPORT();
+            oPORTNAME = string(argv[++i]);
+        }
+        if (cmd == "-hyst")
+        {
+            if (i + 1 >= argc)
+            {
+                cout << "Error ! Please Provide the Hysteresis Width in CC Steps!" << endl;
+                cleanup();
+            }
+            HYSTERESIS.WIDTH = atoi(argv[++i]);
+        }
+        if (cmd == "-coalesce")
+        {
+            if (i + 1 >= argc)
+            {
+                cout << "Error ! Please Provide the Coalescing Window in ms!" << endl;
+                cleanup();
+            }
+            SCHED.PARAMS.BOUND_US = atoi(argv[++i]) * 1000LL;
+        }
+        if (cmd == "-drop")
+        {
+            if (i + 1 >= argc)
+            {
+                cout << "Error ! Please Provide the Drop Policy (oldest or newest)!" << endl;
+                cleanup();
+            }
+            OUTQ.DROP_POLICY = string(argv[++i]) == "newest" ? DROP_NEWEST : DROP_OLDEST;
+        }
+        if (cmd == "-resync")
+        {
+            if (i + 1 >= argc)
+            {
+                cout << "Error ! Please Provide the Resync Mode (diff or full)!" << endl;
+                cleanup();
+            }
+            FULL_RESYNC = string(argv[++i]) == "full";
+        }
+        if (cmd == "-nobulk")
+            bulk = false;
+        if (cmd == "-epoll")
+            SINGLE_THREAD = true;
+        if (cmd == "-route")
+            KERNEL_ROUTE = true;
+        if (cmd == "-stream" && !midiIn->setSysexStreaming())
+            cout << "-stream is not supported here, SysEx is forwarded once complete" << endl;
+        if (cmd == "-bench")
+        {
+            runBench(i + 1 < argc ? atoi(argv[++i]) : 0);
+            cleanup();
         }
     }
+    if (KERNEL_ROUTE && oPORTNAME == "")
+    {
+        cout << "-route needs a hardware port (-p), ignored" << endl;
+        KERNEL_ROUTE = false;
+    }
+    if (oPORTNAME != "")
+        initHWPORT();
     if (oPORTNAME == "")
     {
         SYX->openVirtualPort(PORT_PREFIX + "SYX");
         cout << "dxsex => Created Virtual Output Port: " << PORT_PREFIX << "SYX" << endl;
     }
+    SCHED.CACHE = bulk ? &SENT_CACHE : 0;
+    SCHED.DEVICE = oPORTNAME == "" ? DEV_VIRTUAL : DEV_HW;
+    if (SINGLE_THREAD && !(midiIn->setExternalLoop() && LOOP.open()))
+    {
+        cout << "-epoll is not supported here, running threaded" << endl;
+        midiIn->setExternalLoop(false);
+        SINGLE_THREAD = false;
+    }
+    sigset_t stopSignals, mainSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &mainSignals); // inherited by the threads started below
+    if (!SINGLE_THREAD)
+        OUT_THREAD = std::thread(outputThread);
     midiIn->openVirtualPort(PORT_PREFIX + "CC");
     cout << "dxsex => Created Virtual Input Port: " << PORT_PREFIX + "CC" << endl;
     cout << "Send Your CC Commands to PORT: " << PORT_PREFIX << "CC" << endl;
 
-    while (true)
+    if (oPORTNAME != "" && WATCH.open())
+        cout << "Watching for " << oPORTNAME << " to come and go" << endl;
+    if (SINGLE_THREAD)
+        runLoop(); // does not return
+    pthread_sigmask(SIG_SETMASK, &mainSignals, 0);
+
+    while (!STOP)
     {
-        if (oPORTNAME != "")
+        if (oPORTNAME == "")
+        {
+            // nothing to reconnect, the output thread does the work
+            pthread_sigmask(SIG_BLOCK, &stopSignals, 0);
+            if (!STOP)
+                sigsuspend(&mainSignals); // no Ctrl-C lost between the check and the wait
+            pthread_sigmask(SIG_SETMASK, &mainSignals, 0);
+        }
+        else if (WATCH.isOpen())
+        {
+            // Sleeps until a port comes or goes. A port that failed while
+            // still listed is retried every 30 seconds as well.
+            int events = WATCH.wait(HW.up() ? -1 : 30000);
+            checkHWPORT((events & (WATCH_APPEARED | WATCH_VANISHED)) != 0);
+        }
+        else
         {
             long elapsed = getSecs() - nextCheck;
             if (elapsed >= 30)  // Check every 30 seconds (not 2)
             {
-                // Only reopen if port was disconnected—don't scan repeatedly
-                if (HW_EXISTS == false)
-                {
-                    initHWPORT();  // Attempt reconnect
-                }
+                checkHWPORT(true); // no announcements to go by, look the port up again
                 nextCheck = getSecs() + 30;
             }
+            usleep(100000);
         }
-
-        usleep(100000);  // 100ms
     }
+    cout << "Interrupt signal (" << STOP << ") received.\n";
+    cout << "Process dxsex Terminiated!" << endl;
+    cleanup();
 }
-void onMIDI(double deltatime, std::vector<unsigned char> *message, void * /*userData*/) // handles incomind midi
+void onMIDI(long long deltaUs, const unsigned char *bytes, size_t size, void * /*userData*/) // handles incomind midi
 {
-
-    unsigned char byte0 = (int)message->at(0);
-    unsigned char typ = byte0 & 0xF0;
-    unsigned char ch = byte0 & 0x0F;
-    uint size = message->size();
-    if (size == 1 || byte0 == 0xF0 || typ != 0xB0) // sysex or clock or non cc
+    unsigned long allocsBefore = THREAD_ALLOCS;
+    translate(bytes, size);
+    HOT_ALLOCS += THREAD_ALLOCS - allocsBefore;
+    HOT_MESSAGES++;
+}
+// Everything ALSA had pending, in arrival order. A knob value that a later
+// one in the same run of CCs replaces is not translated, and the output
+// thread is woken once for the whole burst.
+void onBatch(const RtMidiIn::RtMidiInRecord *records, size_t count, void * /*userData*/)
+{
+    unsigned long allocsBefore = THREAD_ALLOCS;
+    HOLD_WAKE = true;
+    for (size_t i = 0; i < count; i++)
     {
-        sendMessage(message);
+        if (!superseded(records, i, count))
+            translate(records[i].bytes, records[i].size);
     }
+    HOLD_WAKE = false;
+    if (!SINGLE_THREAD)
+        OUTQ.wake();
+    HOT_ALLOCS += THREAD_ALLOCS - allocsBefore;
+    HOT_MESSAGES += count;
+}
+void translate(const unsigned char *bytes, size_t size)
+{
+    unsigned char byte0 = bytes[0];
+    unsigned char typ = byte0 & 0xF0;
+    if (size < 3 || byte0 == 0xF0 || typ != 0xB0) // sysex or clock or non cc
+        sendMessage(bytes, size);
     else
+        translateCC(byte0, bytes[1] & 0x7F, bytes[2] & 0x7F);
+}
+// True if records[i] is a CC mapped to a parameter change that a later CC
+// of the same knob replaces before any other message comes in between.
+// CCs mapped to CCs are all kept, the synth may care about every step.
+bool superseded(const RtMidiIn::RtMidiInRecord *records, size_t i, size_t count)
+{
+    const unsigned char *m = records[i].bytes;
+    if (records[i].size != 3 || (m[0] & 0xF0) != 0xB0 || FRAMES.F[m[1] & 0x7F].TYPE != SYSEX)
+        return false;
+    for (size_t j = i + 1; j < count; j++)
     {
-        int mCC = (int)message->at(1);
-        CC_MAPPING C = MAP[mCC];
-        // cout << "MAP: " << C.TYPE << " Param: " << C.PARAMETER << endl;
-        if (C.TYPE == CC || C.TYPE == SYSTEM)
-        {
-            // cout << "CC: " << mCC << endl;
-            message->at(1) = C.CC; // remap incoming CC to target CC as in MAP.
-            sendMessage(message);
-            return;
-        }
-        if (C.TYPE == SYSEX)
-        {
-
-            vector<unsigned char> oSYX = BASE_SYX;
-            int value = limit(message->at(2), C.MIN, C.MAX);
-            oSYX.at(BPOS::GROUP) = C.GROUP;
-            oSYX.at(BPOS::PARAMETER) = C.PARAMETER;
-            oSYX.at(BPOS::DATA) = value;
-            // cout << "CC for Syx: " << mCC << " Value: " << value << endl;
-            sendMessage(&oSYX);
-        }
+        const unsigned char *n = records[j].bytes;
+        if (records[j].size != 3 || (n[0] & 0xF0) != 0xB0)
+            return false;
+        if (n[0] == m[0] && n[1] == m[1])
+            return true;
     }
+    return false;
 }
-
-int limit(int v, int min, int max)
+void translateCC(unsigned char status, unsigned char cc, unsigned char value)
 {
-    if (v < min)
-        v = min;
-    if (v > max)
-        v = max;
-    return v;
+    const CC_FRAME &F = FRAMES.F[cc];
+    unsigned char mapped = VALUE_LUT[cc][value];
+    if (F.TYPE == CC || F.TYPE == SYSTEM)
+    {
+        unsigned char oCC[3] = {status, F.CC, mapped}; // remap incoming CC to target CC as in MAP.
+        if (!KERNEL_ROUTE || F.CC != cc || mapped != value) // -route: the sequencer already delivered it unchanged
+            sendMessage(oCC, 3);
+    }
+    else if (F.TYPE == SYSEX && HYSTERESIS.admit(status & 0x0F, cc, value))
+    {
+        unsigned char oSYX[7];
+        memcpy(oSYX, F.SYX, sizeof(oSYX));
+        oSYX[BPOS::DATA] = mapped;
+        sendMessage(oSYX, sizeof(oSYX)); // a complete frame, MidiOutAlsa sends it without the encoder
+    }
 }
 
 void listInports()
 {
-    uint nPorts = midiIn->getPortCount();
+    vector<RtMidiPortInfo> ports;
+    midiIn->getPorts(ports);
     cout << "************ INPUTS ************" << endl;
-    for (uint i = 0; i < nPorts; i++)
-    {
-        std::string portName = midiIn->getPortName(i);
-        std::cout << portName << "\n";
-    }
+    for (size_t i = 0; i < ports.size(); i++)
+        if (ports[i].caps & RtMidiPortInfo::CAN_INPUT)
+            std::cout << ports[i].name << "\n";
 }
 void listOutPorts()
 {
-    uint nPorts = SYX->getPortCount();
+    vector<RtMidiPortInfo> ports;
+    SYX->getPorts(ports);
     cout << "************ Midi Outputs ************" << endl;
-    for (uint i = 0; i < nPorts; i++)
-    {
-        std::string portName = SYX->getPortName(i);
-        std::cout << portName << "\n";
-    }
+    for (size_t i = 0; i < ports.size(); i++)
+        if (ports[i].caps & RtMidiPortInfo::CAN_OUTPUT)
+            std::cout << ports[i].name << "\n";
 }
 void cleanup()
 {
     delete midiIn;
+    if (OUT_THREAD.joinable())
+    {
+        OUT_RUN = false;
+        OUTQ.wake();
+        OUT_THREAD.join();
+    }
+    else if (SINGLE_THREAD)
+    {
+        SCHED.drain(nowUs(), sendNow); // what the output thread does on its way out
+        flushOutput();
+    }
+    printStats();
     delete SYX;
-    HWOUT->closePort();
-    delete HWOUT;
+    HWOUT.publish(0); // no reader left, closes and deletes the port
     exit(0);
 }
 
-int getinPort(std::string str)
+// First port with caps whose name contains str, one walk over the ports.
+bool findPort(RtMidi *midi, unsigned int caps, const std::string &str, RtMidiPortInfo &found)
 {
-    int nPorts = midiIn->getPortCount();
-    for (int i = 0; i < nPorts; i++)
+    vector<RtMidiPortInfo> ports;
+    midi->getPorts(ports);
+    for (size_t i = 0; i < ports.size(); i++)
     {
-        std::string portName = midiIn->getPortName(i);
-        size_t found = portName.find(str);
-        if (found != string::npos)
+        if ((ports[i].caps & caps) && ports[i].name.find(str) != string::npos)
         {
-            return i;
+            found = ports[i];
+            return true;
         }
     }
-    return 99;
+    return false;
 }
-int getOutPort(std::string str)
+// Looks oPORTNAME up unless the cached address is still current.
+bool resolveHWPORT()
 {
-    int nPorts = SYX->getPortCount();
-    for (int i = 0; i < nPorts; i++)
-    {
-        std::string portName = SYX->getPortName(i);
-        size_t found = portName.find(str);
-        if (found != string::npos)
-        {
-            return i;
-        }
-    }
-    return -1;
+    if (!HW_RESOLVED)
+        HW_RESOLVED = findPort(SYX, RtMidiPortInfo::CAN_OUTPUT, oPORTNAME, HW_ADDR);
+    return HW_RESOLVED;
 }
 void initHWPORT()
 {
-    int oid = getOutPort(oPORTNAME);
-    if (oid != -1)
+    if (resolveHWPORT())
     {
-        if (HWOUT->isPortOpen())
-        {
-            HWOUT->closePort();
-        }
-        try
+        RtMidiOut *port = new RtMidiOut();
+        port->setErrorCallback(&onOutputError); // openPort() must not throw, checked with isPortOpen()
+        port->openPort(HW_ADDR, PORT_PREFIX + "SYX");
+        if (port->isPortOpen())
         {
-            HWOUT->openPort((unsigned int)oid, PORT_PREFIX + "SYX");
-            HW_EXISTS = true;
-            cout << "Opened HW Port (" << SYX->getPortName(oid) << " as " << PORT_PREFIX << "SYX) for Output with ID: " << oid << endl;
+            HWOUT.publish(port); // before HW.open(), a writer that sees the port up gets this one
+            HW.open();
+            if (KERNEL_ROUTE && !midiIn->setKernelRoute(HW_ADDR))
+            {
+                KERNEL_ROUTE = false; // not ALSA or not routable, everything comes through onBatch/onMIDI again
+                cout << "-route: kernel routing unavailable, passing everything through" << endl;
+            }
+            cout << "Opened HW Port (" << HW_ADDR.name << " as " << PORT_PREFIX << "SYX) for Output" << endl;
         }
-        catch (...)
+        else
         {
-            HW_EXISTS = false;
-            cout << "Error Opening: " << SYX->getPortName(oid) << "for Output" << endl;
+            cout << "Error Opening: " << HW_ADDR.name << "for Output" << endl;
+            delete port;
         }
     }
     else
     {
-        HW_EXISTS = false;
         cout << oPORTNAME << "Not Available Yet" << endl;
     }
 }
-void sendMessage(vector<unsigned char> *message)
+// Only reopen if port was disconnected—don't scan repeatedly. The ports
+// are only walked again after an announcement (announced), otherwise the
+// cached address is retried.
+void checkHWPORT(bool announced)
 {
-    if (oPORTNAME == "")
-        SYX->sendMessage(message);
-    else
+    if (announced)
+        HW_RESOLVED = false;
+    if (HW.up() && !resolveHWPORT() && HW.fail())
+        cout << oPORTNAME << " Disconnected" << endl; // output keeps tracking TARGET until it is back
+    if (!HW.up())
     {
-
-        try
-        {
-            HWOUT->sendMessage(message);
-        }
-        catch (...)
+        initHWPORT();  // Attempt reconnect
+        if (HW.up())
         {
-            cout << "Error Sendind Midi to: " << oPORTNAME << endl;
+            RESYNC = true;
+            OUTQ.wake();
         }
     }
 }
+void sendMessage(const unsigned char *message, size_t size)
+{
+    if (SINGLE_THREAD)
+        outputMessage(message, size);
+    else
+        OUTQ.push(message, size, !HOLD_WAKE);
+}
+void outputMessage(const unsigned char *message, size_t size)
+{
+    TARGET.apply(message, size);
+    if (KERNEL_ROUTE && size == 2 && (message[0] & 0xF0) == 0xC0)
+    {
+        SENT_CACHE.admit(DEV_HW, message, size); // the sequencer delivered it, the synth's voice is unknown now
+        return;
+    }
+    SCHED.push(message, size, nowUs(), sendNow);
+}
+// Replays TARGET after a reconnect, releases what the wire has room for
+// and flushes. Returns when to come back, -1 if nothing is queued.
+long long serviceOutput()
+{
+    if (RESYNC.exchange(false))
+    {
+        if (FULL_RESYNC)
+            SENT_CACHE.forget(DEV_HW);
+        REPLAYED += SCHED.replay(TARGET, SENT_CACHE.synth(DEV_HW), nowUs());
+    }
+    long long now = nowUs();
+    SCHED.service(now, sendNow);
+    flushOutput(); // one write for everything sent this round
+    return SCHED.nextWake(now);
+}
+void outputThread()
+{
+    const unsigned char *m;
+    size_t size;
+    while (OUT_RUN)
+    {
+        while (OUTQ.pop(m, size))
+            outputMessage(m, size);
+        long long now = nowUs();
+        long long due = serviceOutput();
+        OUTQ.wait(due < 0 ? 100000 : std::min(100000LL, due - now)); // 100ms, or until queued output is due
+    }
+    while (OUTQ.pop(m, size)) // shutting down, flush what is left
+        SCHED.push(m, size, nowUs(), sendNow);
+    SCHED.drain(nowUs(), sendNow);
+    flushOutput();
+}
+bool sendNow(const unsigned char *message, size_t size)
+{
+    int device = oPORTNAME == "" ? DEV_VIRTUAL : DEV_HW;
+    if (device == DEV_HW && !HW.up())
+    {
+        HW.DROPPED++;
+        return false; // TARGET has it, it is replayed on reconnect
+    }
+    if (!SENT_CACHE.admit(device, message, size))
+        return false;
+    RtMidiOut::SendStatus status;
+    if (device == DEV_VIRTUAL)
+        status = SYX->tryQueueMessage(message, size);
+    else
+    {
+        status = HWOUT.enter(OUT_READER)->tryQueueMessage(message, size);
+        HWOUT.leave(OUT_READER);
+    }
+    if (status == RtMidiOut::SEND_OK)
+        return true;
+    SENT_CACHE.forget(device, message, size); // the synth does not have it
+    if (status == RtMidiOut::SEND_PORT_GONE && device == DEV_HW)
+        hwFailed();
+    return false;
+}
+void hwFailed()
+{
+    SENT_CACHE.rollback(DEV_HW); // what was still buffered is lost, the rest reached the synth
+    if (HW.fail())
+    {
+        cout << "Error Sendind Midi to: " << oPORTNAME << ", holding changes until it is back" << endl;
+        WATCH.wake();
+    }
+}
+// Errors of the -p port outside the send path (sends report through their
+// status, see sendNow()). Printed instead of thrown, so a port that cannot
+// be opened leaves the retry to checkHWPORT().
+void onOutputError(RtMidiError::Type type, const std::string &errorText, void * /*userData*/)
+{
+    cout << "HW port: " << errorText << endl;
+}
+void flushOutput()
+{
+    if (oPORTNAME == "")
+    {
+        if (SYX->tryFlushMessages() == RtMidiOut::SEND_OK)
+            SENT_CACHE.commit(DEV_VIRTUAL);
+    }
+    else if (HW.up())
+    {
+        RtMidiOut::SendStatus status = HWOUT.enter(OUT_READER)->tryFlushMessages();
+        HWOUT.leave(OUT_READER);
+        if (status == RtMidiOut::SEND_OK)
+            SENT_CACHE.commit(DEV_HW);
+        else if (status == RtMidiOut::SEND_PORT_GONE)
+            hwFailed(); // a would-block stays buffered for the next flush
+    }
+}
+void printStats()
+{
+#ifdef TXSEX_COUNT_ALLOCS
+    cout << "Translated " << HOT_MESSAGES << " messages with " << HOT_ALLOCS << " heap allocations" << endl;
+#else
+    cout << "Translated " << HOT_MESSAGES << " messages" << endl;
+#endif
+    unsigned long dropped = SENT_CACHE.DROPPED + HYSTERESIS.DROPPED;
+    cout << "Parameter changes sent: " << SENT_CACHE.SENT << ", duplicates dropped: " << SENT_CACHE.DROPPED
+         << ", jitter dropped: " << HYSTERESIS.DROPPED << ", merged: " << SCHED.PARAMS.MERGED << endl;
+    dropped += SCHED.PARAMS.MERGED;
+    cout << "Saved " << dropped * 7 << " bytes (" << dropped * 7 * DIN_BYTE_US / 1000 << " ms of DIN time)" << endl;
+    cout << "Sent realtime: " << SCHED.SENT[LANE_REALTIME] << ", notes: " << SCHED.SENT[LANE_NOTE]
+         << ", CC: " << SCHED.SENT[LANE_CC] << ", SysEx: " << SCHED.SENT[LANE_SYSEX]
+         << ", notes held for queued edits: " << SCHED.BARRIERS << endl;
+    cout << "Values replayed after reconnects: " << REPLAYED << ", port failures: " << HW.FAILURES
+         << ", sends skipped while the port was down: " << HW.DROPPED << endl;
+    cout << "Voice bulk dumps sent: " << SCHED.BULKS << " in place of " << SCHED.BULK_PARAMS << " parameter changes" << endl;
+    cout << "SysEx pieces streamed: " << SCHED.STREAMED << ", cut off: " << SCHED.STREAM_ABORTS
+         << ", held back and dropped: " << SCHED.HOLD_DROPPED << endl;
+    cout << "Output queue: parameter changes dropped: " << OUTQ.paramDropped() << ", input stalls: " << OUTQ.STALLS
+         << ", SysEx too long: " << OUTQ.TOO_LONG << endl;
+    RtMidiOut *port = oPORTNAME == "" ? SYX : HWOUT.current();
+    if (!port)
+        return;
+    RtMidiOutStats out = port->getOutputStats(); // the -p port counts since its last reopen
+    cout << "Port writes: " << out.writes << " for " << out.messages << " messages, would block: " << out.wouldBlock
+         << ", port gone: " << out.portGone << ", encode errors: " << out.encodeErrors << endl;
+}
 long long getSecs() // gets time since epch in seconds
 {
     auto t1 = std::chrono::system_clock::now();
     long long us = duration_cast<seconds>(t1.time_since_epoch()).count();
     return us;
 }
-void signalHandler(int signum)
+// -epoll main loop. Input, hotplug and the output timer all wake the same
+// epoll_wait, SIGINT/SIGTERM arrive through it too, so shutdown happens
+// between two events and always drains the queued output.
+void runLoop()
 {
-    cout << "Interrupt signal (" << signum << ") received.\n";
+    int fds[16];
+    LOOP.add(fds, midiIn->getPollDescriptors(fds, 16), LOOP_INPUT);
+    if (WATCH.isOpen())
+        LOOP.add(fds, WATCH.descriptors(fds, 16), LOOP_HOTPLUG);
+    long long retry = oPORTNAME == "" ? -1 : 0; // next port check without an announcement
+    LOOP.arm(retry);
+    while (!STOP) // a Ctrl-C before LOOP.open() went to signalHandler
+    {
+        int events = LOOP.wait();
+        if (events & LOOP_SIGNAL)
+            break;
+        if (events & LOOP_INPUT)
+            midiIn->processEvents();
+        int watched = WATCH_NONE;
+        if (events & LOOP_HOTPLUG)
+            watched = WATCH.read();
+        if ((events & LOOP_HOTPLUG) || (retry >= 0 && nowUs() >= retry))
+        {
+            checkHWPORT(!WATCH.isOpen() || (watched & (WATCH_APPEARED | WATCH_VANISHED)));
+            // with the watcher only a port that failed while still listed needs polling
+            retry = WATCH.isOpen() && HW.up() ? -1 : nowUs() + 30000000;
+        }
+        long long due = serviceOutput();
+        if (retry >= 0 && (due < 0 || retry < due))
+            due = retry;
+        LOOP.arm(due);
+    }
     cout << "Process dxsex Terminiated!" << endl;
     cleanup();
-}
\ No newline at end of file
+}
+void signalHandler(int signum)
+{
+    STOP = signum;
+    WATCH.wake(); // a write(), the one call here that is safe in a handler
+}
+
+#ifdef TXSEX_COUNT_ALLOCS
+// Counting replacements for the global allocation functions (see THREAD_ALLOCS).
+// Every form goes through the same pair, so no delete is ever paired with
+// a different allocator than its new.
+static void *countedAlloc(std::size_t size) noexcept
+{
+    THREAD_ALLOCS++;
+    return malloc(size ? size : 1);
+}
+__attribute__((noinline)) static void countedFree(void *p) noexcept
+{
+    free(p);
+}
+void *operator new(std::size_t size)
+{
+    void *p = countedAlloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+void operator delete(void *p) noexcept
+{
+    countedFree(p);
+}
+void operator delete[](void *p) noexcept
+{
+    countedFree(p);
+}
+void operator delete(void *p, std::size_t) noexcept
+{
+    countedFree(p);
+}
+void operator delete[](void *p, std::size_t) noexcept
+{
+    countedFree(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    countedFree(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    countedFree(p);
+}
+#endif
@@ -0,0 +1,67 @@
+// Checks of the output scheduler's send order, run by ctest.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "TxOut.h"
+
+static std::vector<std::vector<unsigned char>> SENT;
+
+static bool record(const unsigned char *m, size_t size)
+{
+    SENT.push_back(std::vector<unsigned char>(m, m + size));
+    return true;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// A parameter change held by the coalescer goes out before a later
+// program change on the wire, not after it.
+static void paramBeforeProgram()
+{
+    OUT_SCHEDULER sched;
+    SENT.clear();
+    sched.PARAMS.BOUND_US = 20000;
+    unsigned char first[7] = {0xF0, 0x43, 0x10, 0x12, 0x05, 0x10, 0xF7};
+    unsigned char second[7] = {0xF0, 0x43, 0x10, 0x12, 0x05, 0x20, 0xF7};
+    unsigned char program[2] = {0xC0, 0x03};
+    long long now = 1000000;
+    sched.push(first, sizeof(first), now, record);
+    sched.push(second, sizeof(second), now + 1, record); // inside BOUND_US: held
+    check(SENT.size() == 1, "second parameter change held");
+    sched.push(program, sizeof(program), now + 2, record);
+    sched.drain(now + 3, record);
+    check(SENT.size() == 3, "three messages sent");
+    check(SENT.size() == 3 && SENT[1] == std::vector<unsigned char>(second, second + 7), "held change second");
+    check(SENT.size() == 3 && SENT[2] == std::vector<unsigned char>(program, program + 2), "program change last");
+}
+
+// Queued CCs go out before a program change of any channel.
+static void controlBeforeProgram()
+{
+    OUT_SCHEDULER sched;
+    SENT.clear();
+    sched.BACKLOG_US = 0; // queue every CC
+    unsigned char cc[3] = {0xB1, 7, 100};
+    unsigned char program[2] = {0xC0, 0x03};
+    sched.push(cc, sizeof(cc), 0, record);
+    sched.push(program, sizeof(program), 0, record);
+    check(SENT.size() == 2 && SENT[0][0] == 0xB1 && SENT[1][0] == 0xC0, "CC before program change");
+}
+
+int main()
+{
+    paramBeforeProgram();
+    controlBeforeProgram();
+    if (failures == 0)
+        printf("ok\n");
+    return failures ? 1 : 0;
+}